@@ -4,9 +4,16 @@ import random
 import subprocess
 from typing import Optional, TypeAlias
 import time
-from multiprocessing import Pool
+import sys
 from copy import deepcopy
 
+# in-process simulation module, if it was built (see simulation-cpp/python_module.cpp), else the binary is used
+sys.path.append("simulation-cpp")
+try:
+    import fish_simulation
+except ImportError:
+    fish_simulation = None
+
 
 Individual: TypeAlias = list[float]
 
@@ -41,53 +48,61 @@ def generate_population(
     return [generate_individual(individual_len) for _ in range(num_population)]
 
 
-def get_simulation_result(individual: Individual) -> tuple[int, int]:
-    """Run the simulation with individual's parameters as arguments"""
-    
+# names of the simulation parameters in the individual (as the simulator's CLI options), in order
+SIMULATION_PARAMS = ["fish-momentum", "alignment", "cohesion", "separation", "shark-repulsion", "food-attraction"]
+
+
+def get_simulation_results(
+        population: list[Individual],
+        simulations_per_indiv: int,
+        ) -> list[list[tuple[int, int]]]:
+    """
+    Run `simulations_per_indiv` simulations with each individual's parameters.
+    All of them run in parallel - in-process if the simulation module is built, else in one batch of the simulator.
+    Return their pairs <fish_dead, food_eaten> per individual.
+    """
+    if fish_simulation is not None:
+        results = fish_simulation.simulate_population(population, replicates=simulations_per_indiv)
+        return [[(run["fish_eaten"], run["food_eaten"]) for run in runs] for runs in results]
+
+    batch = "\t".join(SIMULATION_PARAMS[:len(population[0])]) + "\n"
+    batch += "".join("\t".join(str(param) for param in individual) + "\n" for individual in population)
+
     output = subprocess.run([
-        './simulation-cpp/cpp_simulation', 
-        '--debug', 'false',
-        "--fish-momentum", str(individual[0]),
-        "--alignment", str(individual[1]),
-        "--cohesion", str(individual[2]),
-        "--separation", str(individual[3]),
-        "--shark-repulsion", str(individual[4]),
-        "--food-attraction",  str(individual[5]),
-        ], stdout=subprocess.PIPE)
+        './simulation-cpp/cpp_simulation',
+        '--batch', '-',
+        '--replicates', str(simulations_per_indiv),
+        ], input=batch.encode("utf-8"), stdout=subprocess.PIPE)
     output = output.stdout.decode("utf-8").strip()
 
-    # output is in form "TOTAL FISH EATEN: N\nTOTAL FOOD EATEN: N" - return the number
-    return int(output.split('\n')[0].split()[-1]), int(output.split('\n')[1].split()[-1])
+    # output has a header, then one line "row replicate seed fish_eaten food_eaten" (TSV) per simulation
+    results = [[] for _ in population]
+    for line in output.split('\n')[1:]:
+        row, _, _, fish_eaten, food_eaten = line.split('\t')
+        results[int(row)].append((int(fish_eaten), int(food_eaten)))
+    return results
 
 
-def eval_individual(
-        individual: Individual, 
-        simulations_per_indiv: int,
+def get_fitness(
+        result_tuples: list[tuple[int, int]],
         food_weight: float,
         log_file,
         ) -> float:
     """
-    Evaluate fitness of a `individual`.
-    That means run the simulation `simulations_per_indiv` times, and take average.
-    We will run them in parallel.
+    Fitness of an individual from the results of its simulations - the average.
     """
-    # run all simulations in parallel
-    with Pool(simulations_per_indiv) as pool:
-        async_results = [pool.apply_async(get_simulation_result, args=([individual])) for _ in range(simulations_per_indiv)]
-        result_tuples = [ar.get() for ar in async_results]
-        # results are pairs of <fish_dead, food_eaten>, combine them to get one number
-
-        aggregated_results = [res_tuple[0] - food_weight * res_tuple[1] for res_tuple in result_tuples]
-        score = sum(aggregated_results) / simulations_per_indiv
-
-        """ food printing for experiments with objective function
-        average_dead = sum([res_tuple[0] for res_tuple in result_tuples]) / simulations_per_indiv
-        average_food = sum([res_tuple[1] for res_tuple in result_tuples]) / simulations_per_indiv
-        log(log_file, f"avg dead: {int(average_dead)}, avg food: {int(average_food)}, score: {int(score)}")
-        """
-
-        return score
-    
+    # results are pairs of <fish_dead, food_eaten>, combine them to get one number
+    aggregated_results = [res_tuple[0] - food_weight * res_tuple[1] for res_tuple in result_tuples]
+    score = sum(aggregated_results) / len(result_tuples)
+
+    """ food printing for experiments with objective function
+    average_dead = sum([res_tuple[0] for res_tuple in result_tuples]) / len(result_tuples)
+    average_food = sum([res_tuple[1] for res_tuple in result_tuples]) / len(result_tuples)
+    log(log_file, f"avg dead: {int(average_dead)}, avg food: {int(average_food)}, score: {int(score)}")
+    """
+
+    return score
+
 
 def eval_population(
         population: list[Individual], 
@@ -96,7 +111,8 @@ def eval_population(
         log_file,
         ) -> list[tuple[Individual, float]]:
     """Evaluate fitness of whole population, return list of tuples <individual, fitness>."""
-    return [(indiv, eval_individual(indiv, simulations_per_indiv, food_weight, log_file)) for indiv in population]
+    results = get_simulation_results(population, simulations_per_indiv)
+    return [(indiv, get_fitness(result_tuples, food_weight, log_file)) for indiv, result_tuples in zip(population, results)]
 
 
 def get_fittest_individual(
@@ -1,89 +1,117 @@
-#include <vector>
-#include <iostream>
-#include <cmath>
-#include <ctime>
-#include <nlohmann/json.hpp>
-#include <random>
-#include <fstream>
-#include "glm/glm/glm.hpp"
-#include "glm/glm/gtx/norm.hpp"
-#include "glm/glm/gtx/vector_angle.hpp"
+#include "simulation.hpp"
+#include <sstream>
+#include <csignal>
+#include <cerrno>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <memory>
+#include <atomic>
+#include <chrono>
 #include <boost/program_options.hpp>
 
 
-using namespace std;
-
-// We have two types of model parameters:
-
-// 1) OPTIMIZABLE MODEL PARAMETERS - these will be used for parameter optimisation
-// their values can be given via CLI arguments
-// basically factors to multiply various forces of FISH
-float FISH_MOMENTUM_CONSTANT = 0.75;
-float FISH_FEAR_MOMENTUM_CONSTANT = 0.8; // will be automatically changed to correspond to FISH_MOMENTUM_CONSTANT
-float ALIGNMENT_CONSTANT = 0.25;
-float COHESION_CONSTANT = 0.05;
-float SEPARATION_CONSTANT = 20.;
-float SHARK_REPULSION_CONSTANT = 8.;
-float FOOD_ATTRACTION_CONSTANT = 0.25;
-
-// 2) FIXED MODEL PARAMETERS - similar, but not to be optimized via evolution
-// mostly shark parameters, or scene params
-constexpr int WIDTH = 400;                      // scene width
-constexpr int HEIGHT = 400;                     // scene height
-
-constexpr int NUM_STEPS = 1000;                 // number of steps to simulate
-constexpr int NUM_FISH = 400;                   // total number of fish
-constexpr int NUM_SHARKS = 1;                   // number of sharks
-constexpr int NUM_FOOD = 50;                    // number of food in simulation
-
-constexpr int FISH_SENSE_DIST = 25;             // distance for fish to sense neighbors or food
-constexpr int SHARK_SENSE_DIST = 100;           // distance for shark to sense neighbors
-
-constexpr int FISH_MAX_SPEED = 4;               // maximal speed of fish
-constexpr int SHARK_MAX_SPEED = 7;              // maximal speed of sharks
-
-constexpr int SHARK_KILL_RADIUS = 10;           // distance for which shark can kill
-constexpr float SHARK_MOMENTUM_CONSTANT = 1.;   // constant which manages how much of previous shark direction is preserved
-constexpr float SHARK_SEARCH_CONSTANT = 2.;     // constant which manages behaviour of shark when no fish is around in his SENSE_DIST
-constexpr float SHARK_HUNT_CONSTANT = 40.;      // constant which manages behaviour of shark when there are fish around in his SENSE_DIST
-
-constexpr int FISH_DIM_ELLIPSE_X = 5;           // size of a fish (defined by ellipse) in x-axis
-constexpr int FISH_DIM_ELLIPSE_Y = 9;           // size of a fish (defined by ellipse) in y-axis
-constexpr int FISH_LARGER_DIM = (FISH_DIM_ELLIPSE_X > FISH_DIM_ELLIPSE_Y) ? FISH_DIM_ELLIPSE_X : FISH_DIM_ELLIPSE_Y;
-constexpr int FISH_FEAR_CONSTANT = 3;           // number of steps when fish continues running from the shark
-
-constexpr int SHARK_DIM_ELLIPSE_X = 30;         // size of the shark (defined by ellipse) in x-axis
-constexpr int SHARK_DIM_ELLIPSE_Y = 50;         // size of the shark (defined by ellipse) in y-axis
-constexpr int SHARK_LARGER_DIM = (SHARK_DIM_ELLIPSE_X > SHARK_DIM_ELLIPSE_Y) ? SHARK_DIM_ELLIPSE_X : SHARK_DIM_ELLIPSE_Y;
-
-constexpr int SHARK_BLIND_ANGLE_DEG = 40;       // the angle (in degrees) of a shark that he cannot see. Middle of the blind spot angle is right behind the shark
-
-constexpr bool WALL = false;                    // if true, applies the walls around the canvas, else applies scene warping
-
-// also help/debug/output parameters
-bool debug = true; // this enables printing + logging to json
-bool help = false;
-string LOG_FILEPATH = "output.json";
+// 4) BATCH AND SERVER MODES - many independent simulations in one process (see `runBatch`, `runServer`)
+string BATCH_FILEPATH;      // parameter vectors of the runs, one per line (TSV), "-" for stdin
+int REPLICATES = 1;         // number of runs (with different seeds) of every parameter vector
+string LOG_FISH_IDS;        // comma-separated ids of the logged fish, parsed into LOG_FISH
+string SERVE_ENDPOINT;      // serve parameter requests from stdin ("-") or a UNIX socket of this path (see `runServer`)
 
 void parse_arguments(int argc, char** argv) {
     // Define the command line options
     boost::program_options::options_description desc("Allowed options");
     desc.add_options()
             ("help", "prints help")
+            ("config", boost::program_options::value<string>(), "File with option values (lines 'option = value'), options given on the command line take precedence")
             ("debug", boost::program_options::value<bool>(&debug), "Enable prints for progress")
             ("log-filepath", boost::program_options::value<string>(&LOG_FILEPATH), "File to write the log for visualization to")
+            ("log-format", boost::program_options::value<string>(&LOG_FORMAT), "Format of the log: json, or binary (quantized, see trajectory.hpp)")
+            ("log-delta", boost::program_options::value<bool>(&LOG_DELTA), "Binary log: store frames between key frames as differences")
+            ("log-heading-bits", boost::program_options::value<int>(&LOG_HEADING_BITS), "Binary log: bits per heading (16 or 8)")
+            ("log-keyframe-interval", boost::program_options::value<int>(&LOG_KEYFRAME_INTERVAL), "Binary log: number of frames from one key frame to the next")
+            ("log-queue-size", boost::program_options::value<int>(&LOG_QUEUE_SIZE), "Number of steps that can wait for the log writer thread")
+            ("log-every", boost::program_options::value<int>(&LOG_EVERY), "Log only every k-th step (the visualization interpolates between them)")
+            ("log-from", boost::program_options::value<int>(&LOG_FROM), "First step to log")
+            ("log-to", boost::program_options::value<int>(&LOG_TO), "Log only the steps before this one (-1 = until the end)")
+            ("log-fish", boost::program_options::value<string>(&LOG_FISH_IDS), "Log only the fish of these ids (comma-separated, e.g. 0,5,17)")
+            ("log-near-shark", boost::program_options::value<float>(&LOG_NEAR_SHARK), "Log only the fish within this distance of a shark (0 = all fish)")
+            ("record-before", boost::program_options::value<int>(&RECORD_BEFORE), "Flight recorder: write only clips around kills (files <log>.kill-<step>), each with this many logged steps before the kill (0 = log the whole run)")
+            ("record-after", boost::program_options::value<int>(&RECORD_AFTER), "Flight recorder: logged steps of a clip after its kill (a kill among them extends the clip)")
+            ("sync", boost::program_options::value<bool>(&SYNC_UPDATE), "Update all entities from the previous step's state (parallel, deterministic for any number of threads)")
+            ("threads", boost::program_options::value<int>(&NUM_THREADS), "Number of threads used by the synchronous update, or by the concurrent runs in batch mode (0 = all cores)")
+            ("seed", boost::program_options::value<uint64_t>(&SEED), "Seed for the random numbers, runs with the same seed are reproducible (random if not given)")
+            ("fast-math", boost::program_options::value<bool>(&FAST_MATH), "Use faster approximate math in the fish update (relative error below 0.2 %)")
+            ("fast-math-report", boost::program_options::bool_switch(&FAST_MATH_REPORT), "Only report the maximum deviation of the fast-math fish update from the reference one")
+            ("simd", boost::program_options::value<string>(&SIMD), "Kernel for the fish neighbourhood sums: auto, avx2, sse4.2, neon or scalar")
+            ("simd-report", boost::program_options::bool_switch(&SIMD_REPORT), "Only report the maximum deviation of the selected kernel from the scalar one")
+            ("verlet-skin", boost::program_options::value<float>(&VERLET_SKIN), "Keep fish neighbour lists over steps, with this skin beyond the sense distance (0 = query the grid every step)")
+            ("spatial-index", boost::program_options::value<string>(&SPATIAL_INDEX), "Index of fish for the neighbour queries: grid, quadtree (for dense clusters), or auto (chosen every step by how crowded the grid cells are)")
+            ("quadtree-crowding", boost::program_options::value<float>(&QUADTREE_CROWDING), "Auto index: use the quadtree when a fish shares its grid cell with more than this many fish on average")
+            ("mean-field", boost::program_options::value<int>(&MEAN_FIELD), "Approximate cohesion, alignment and the separation of farther fish by sums over cells this many times smaller than the sense distance (0 = exact neighbours)")
+            ("mean-field-close", boost::program_options::value<float>(&MEAN_FIELD_CLOSE), "Mean field: separation and collisions use the exact neighbours within this distance")
+            ("mean-field-report", boost::program_options::bool_switch(&MEAN_FIELD_REPORT), "Only report the deviation of the mean-field fish update from the exact one, and compare whole runs of both")
+            ("sort-every", boost::program_options::value<int>(&SORT_EVERY), "Re-sort the fish in memory by their place in the scene every this many steps (0 = never), the results stay the same")
+            ("batch", boost::program_options::value<string>(&BATCH_FILEPATH), "Run many simulations concurrently, their parameters are read from this TSV file ('-' for stdin) and one result row per run is printed")
+            ("serve", boost::program_options::value<string>(&SERVE_ENDPOINT), "Keep running and evaluate parameter requests from stdin ('-') or a UNIX socket of this path, results are streamed back")
+            ("replicates", boost::program_options::value<int>(&REPLICATES), "Number of runs of every parameter vector in batch and server modes")
             ("fish-momentum", boost::program_options::value<float>(&FISH_MOMENTUM_CONSTANT), "Momentum constant for fish")
             ("alignment", boost::program_options::value<float>(&ALIGNMENT_CONSTANT), "Alignment constant")
             ("cohesion", boost::program_options::value<float>(&COHESION_CONSTANT), "Cohesion constant")
             ("separation", boost::program_options::value<float>(&SEPARATION_CONSTANT), "Separation constant")
             ("shark-repulsion", boost::program_options::value<float>(&SHARK_REPULSION_CONSTANT), "Shark repulsion constant")
-            ("food-attraction", boost::program_options::value<float>(&FOOD_ATTRACTION_CONSTANT), "Fish food attraction constant");
+            ("food-attraction", boost::program_options::value<float>(&FOOD_ATTRACTION_CONSTANT), "Fish food attraction constant")
+            ("width", boost::program_options::value<int>(&WIDTH), "Scene width")
+            ("height", boost::program_options::value<int>(&HEIGHT), "Scene height")
+            ("num-steps", boost::program_options::value<int>(&NUM_STEPS), "Number of steps to simulate")
+            ("num-fish", boost::program_options::value<int>(&NUM_FISH), "Number of fish")
+            ("num-sharks", boost::program_options::value<int>(&NUM_SHARKS), "Number of sharks")
+            ("num-food", boost::program_options::value<int>(&NUM_FOOD), "Number of food pieces")
+            ("fish-sense-dist", boost::program_options::value<int>(&FISH_SENSE_DIST), "Distance for fish to sense neighbours or food")
+            ("fish-neighbours", boost::program_options::value<int>(&FISH_NEIGHBOURS), "Fish follow only this many nearest neighbours within the sense distance, at most 64 (0 = all of them)")
+            ("shark-sense-dist", boost::program_options::value<int>(&SHARK_SENSE_DIST), "Distance for sharks to sense fish")
+            ("fish-max-speed", boost::program_options::value<int>(&FISH_MAX_SPEED), "Maximal speed of fish")
+            ("shark-max-speed", boost::program_options::value<int>(&SHARK_MAX_SPEED), "Maximal speed of sharks")
+            ("shark-kill-radius", boost::program_options::value<int>(&SHARK_KILL_RADIUS), "Distance for which a shark can kill")
+            ("shark-momentum", boost::program_options::value<float>(&SHARK_MOMENTUM_CONSTANT), "Momentum constant for sharks")
+            ("shark-search", boost::program_options::value<float>(&SHARK_SEARCH_CONSTANT), "Shark search constant (no fish around)")
+            ("shark-hunt", boost::program_options::value<float>(&SHARK_HUNT_CONSTANT), "Shark hunt constant (fish around)")
+            ("fish-dim-x", boost::program_options::value<int>(&FISH_DIM_ELLIPSE_X), "Size of a fish (ellipse) in x-axis")
+            ("fish-dim-y", boost::program_options::value<int>(&FISH_DIM_ELLIPSE_Y), "Size of a fish (ellipse) in y-axis")
+            ("fish-fear-steps", boost::program_options::value<int>(&FISH_FEAR_CONSTANT), "Number of steps a fish keeps running from the shark")
+            ("shark-dim-x", boost::program_options::value<int>(&SHARK_DIM_ELLIPSE_X), "Size of a shark (ellipse) in x-axis")
+            ("shark-dim-y", boost::program_options::value<int>(&SHARK_DIM_ELLIPSE_Y), "Size of a shark (ellipse) in y-axis")
+            ("shark-blind-angle", boost::program_options::value<int>(&SHARK_BLIND_ANGLE_DEG), "Blind angle (in degrees) behind a shark")
+            ("wall", boost::program_options::value<bool>(&WALL), "Walls around the canvas (else the scene wraps around)");
 
     // Parse the command line arguments
     boost::program_options::variables_map vm;
     boost::program_options::store(boost::program_options::parse_command_line(argc, argv, desc), vm);
+    if (vm.count("config")) {
+        // values already stored from the command line are kept
+        std::ifstream config_file(vm["config"].as<string>());
+        if (!config_file)
+            throw boost::program_options::error("cannot open config file " + vm["config"].as<string>());
+        boost::program_options::store(boost::program_options::parse_config_file(config_file, desc), vm);
+    }
     boost::program_options::notify(vm);
 
+    // ids of the logged fish
+    std::stringstream fish_ids(LOG_FISH_IDS);
+    for (string id; std::getline(fish_ids, id, ',');) {
+        try {
+            LOG_FISH.push_back(std::stoi(id));
+        } catch (const std::exception&) {
+            throw boost::program_options::error("invalid fish id '" + id + "' in --log-fish");
+        }
+    }
+
+    // different runs (e.g. replicates in the evolution) must differ, unless the seed is given explicitly
+    if (!vm.count("seed")) {
+        std::random_device rd;
+        SEED = ((uint64_t)rd() << 32) | rd();
+    }
+
     // Print usage message for all options when the help option is provided
     if (vm.count("help")) {
         std::cout << desc << std::endl;
@@ -91,708 +119,457 @@ void parse_arguments(int argc, char** argv) {
     }
 }
 
-template<int canvasWidth, int canvasHeight>
-glm::vec2 getRandomPlace() {
-    return {(float)(rand() % canvasWidth), (float)(rand() % canvasHeight)};
-}
-
-glm::vec2 getRandomDirection() {
-    return {(float)(1 - 2 * (rand() % 2)) * (float) (rand() % 1000000) / 1000000,
-            (float)(1 - 2 * (rand() % 2)) * (float) (rand() % 1000000) / 1000000};
-}
-
-template<int canvasWidth, int canvasHeight>
-glm::vec2 getNearestBorderPoint(glm::vec2 fishPosition) {
-    glm::vec2 nearestPoint;
-
-    // Find the closest border to the fish
-    float leftDist = fishPosition.x;
-    float rightDist = canvasWidth - fishPosition.x;
-    float topDist = fishPosition.y;
-    float bottomDist = canvasHeight - fishPosition.y;
-
-    float minDist = std::min({leftDist, rightDist, topDist, bottomDist});
-
-    // Calculate the nearest point on the border
-    if (minDist == leftDist) {
-        nearestPoint = glm::vec2(0.0f, fishPosition.y);
-    } else if (minDist == rightDist) {
-        nearestPoint = glm::vec2(canvasWidth, fishPosition.y);
-    } else if (minDist == topDist) {
-        nearestPoint = glm::vec2(fishPosition.x, 0.0f);
-    } else if (minDist == bottomDist) {
-        nearestPoint = glm::vec2(fishPosition.x, canvasHeight);
-    }
-
-    return nearestPoint;
-}
-
-template<int canvasWidth, int canvasHeight>
-bool isFishOutOfBorders(glm::vec2 fishPosition) {
-    return (fishPosition.x < 0 || fishPosition.x > canvasWidth || fishPosition.y < 0 || fishPosition.y > canvasHeight);
-}
-
-template<int width1, int height1, int width2, int height2>
-float ellipsesOverlapDistance(glm::vec2 center1, glm::vec2 direction1, glm::vec2 center2, glm::vec2 direction2) {
-    // Normalize the direction vectors
-    glm::vec2 normDirection1 = glm::normalize(direction1);
-    glm::vec2 normDirection2 = glm::normalize(direction2);
-
-    // Calculate the rotation angles for each ellipse
-    float rotation1 = glm::degrees(glm::atan(normDirection1.y, normDirection1.x));
-    float rotation2 = glm::degrees(glm::atan(normDirection2.y, normDirection2.x));
-
-    // Calculate the rotation matrices for each ellipse
-    glm::mat2 rotationMatrix1 = glm::mat2(glm::vec2(glm::cos(glm::radians(rotation1)), glm::sin(glm::radians(rotation1))), glm::vec2(-glm::sin(glm::radians(rotation1)), glm::cos(glm::radians(rotation1))));
-    glm::mat2 rotationMatrix2 = glm::mat2(glm::vec2(glm::cos(glm::radians(rotation2)), glm::sin(glm::radians(rotation2))), glm::vec2(-glm::sin(glm::radians(rotation2)), glm::cos(glm::radians(rotation2))));
-
-    // Transform the centers of the ellipses into the coordinate system of ellipse 1
-    glm::vec2 center2Transformed = rotationMatrix1 * (center2 - center1);
-
-    // Calculate the distance between the transformed centers of the two ellipses
-    float distance = glm::length(center2Transformed);
-
-    // Calculate the radii of each ellipse in the transformed coordinate system
-    glm::vec2 radii1 = glm::vec2(width1 / 2.0f, height1 / 2.0f);
-    glm::vec2 radii2 = glm::vec2(width2 / 2.0f, height2 / 2.0f);
-
-    // Transform the radii of ellipse 2 into the coordinate system of ellipse 1
-    glm::vec2 radii2Transformed = rotationMatrix1 * rotationMatrix2 * radii2;
-
-    // Calculate the sum of the radii in the x and y directions
-    glm::vec2 sumRadii = radii1 + radii2Transformed;
-
-    // Calculate the vector from the center of ellipse 1 to the center of ellipse 2 in the transformed coordinate system
-    glm::vec2 centerVector = glm::normalize(center2Transformed);
-
-    // Calculate the projection of the sum of the radii onto the center vector
-    float overlapDistance = glm::dot(sumRadii, centerVector) - distance;
-
-    return overlapDistance;
-}
-
-// calculates position of mout hof the shark given the center
-glm::vec2 getMouthFromCenter (glm::vec2 pos, glm::vec2 dir) {
-    return pos + (((float)SHARK_DIM_ELLIPSE_Y/2) / glm::length(dir)) * dir;
-}
-
-
-// just some forward definitions due to templates
-template<bool wall, int fish_sense_dist>
-class Food;
+// reads the parameter vectors of the batch and expands them into runs
+// the first line names the columns - optimizable parameters (as their CLI options, e.g. "fish-momentum") and
+// optionally "seed", every other line is one parameter vector; parameters without a column keep their CLI values
+// replicates get consecutive seeds, starting from the seed in the line, or from SEED for the whole batch
+// empty lines and lines starting with '#' are skipped, returns false (and prints why) if the file is invalid
+bool readBatch(std::istream& in, vector<SimulationRun>& runs) {
+    const vector<std::pair<string, float ModelParams::*>> known_columns = {
+            {"fish-momentum", &ModelParams::fish_momentum},
+            {"alignment", &ModelParams::alignment},
+            {"cohesion", &ModelParams::cohesion},
+            {"separation", &ModelParams::separation},
+            {"shark-repulsion", &ModelParams::shark_repulsion},
+            {"food-attraction", &ModelParams::food_attraction},
+    };
 
-// note that this "T" is unrelated to the T of MyClass !
-template<bool wall, int fish_sense_dist>
-bool operator< (const Food<wall, fish_sense_dist> &left, const Food<wall, fish_sense_dist> &right);
+    vector<string> columns;
+    string line;
+    int line_number = 0;
+    int row = 0;
+    while (std::getline(in, line)) {
+        line_number++;
+        if (line.empty() || line[0] == '#')
+            continue;
+
+        vector<string> cells;
+        std::stringstream line_stream(line);
+        string cell;
+        while (std::getline(line_stream, cell, '\t'))
+            cells.push_back(cell);
+
+        if (columns.empty()) {
+            columns = cells;
+            for (const string& column : columns) {
+                bool known = column == "seed" || std::any_of(known_columns.begin(), known_columns.end(),
+                                                             [&](const auto& c) { return c.first == column; });
+                if (!known) {
+                    std::cerr << "batch: unknown column '" << column << "'" << std::endl;
+                    return false;
+                }
+            }
+            continue;
+        }
 
+        if (cells.size() != columns.size()) {
+            std::cerr << "batch: line " << line_number << " has " << cells.size() << " values, expected "
+                      << columns.size() << std::endl;
+            return false;
+        }
 
-// TODO: we now use cheating (mutable attributes) because set<Food> requires Food to be constant...
-template<bool wall, int fish_sense_dist>
-class Food {
-public:
-    using Food_t = Food<wall, fish_sense_dist>;
-
-    int id;
-    mutable glm::vec2 pos;
-    mutable glm::vec2 dir;
-    mutable bool eaten=false;
-
-    Food(int id) {
-        this->id = id;
-        this->pos = getRandomPlace<WIDTH, HEIGHT>();
-    }
-
-    friend bool operator< <>(const Food_t &left, const Food_t &right);
-
-    // TODO: How do we want the food to flow? - for now, just randomly drifts a bit
-    void step() const {
-        // when it is dead, do nothing
-        if (eaten)
-            return;
-
-        this->dir += getRandomDirection();
-        this->dir = glm::normalize(this->dir); // always normalize to only get a small update
-
-        // wall repulsion, if it is enabled (food should not move too close to the wall)
-        if (wall) {
-            glm::vec2 nearest_wall = getNearestBorderPoint<WIDTH, HEIGHT>(this->pos);
-            // food must be possible to reach by fish
-            if (glm::distance(nearest_wall, this->pos) <= (float)fish_sense_dist) {
-                glm::vec2 wall_repulsion_vector = this->pos - nearest_wall;
-                wall_repulsion_vector = glm::normalize(wall_repulsion_vector);
-                wall_repulsion_vector *= 2; // make it bit larger to avoid clustering in corners
-                this->dir = wall_repulsion_vector;
+        ModelParams params = ModelParams::fromGlobals();
+        uint64_t seed = SEED + (uint64_t)row * REPLICATES;
+        try {
+            for (size_t i = 0; i < cells.size(); i++) {
+                if (columns[i] == "seed") {
+                    seed = std::stoull(cells[i]);
+                    continue;
+                }
+                for (const auto& [name, member] : known_columns) {
+                    if (name == columns[i])
+                        params.*member = std::stof(cells[i]);
+                }
             }
+        } catch (const std::logic_error&) {
+            std::cerr << "batch: invalid number on line " << line_number << std::endl;
+            return false;
         }
+        // as for the CLI arguments, fear momentum follows the momentum
+        params.fish_fear_momentum = params.fish_momentum * 1.1;
 
-        this->pos += this->dir;
+        for (int r = 0; r < REPLICATES; r++) {
+            runs.push_back({row, r, seed + r, params});
+        }
+        row++;
     }
-};
+    return true;
+}
 
+// runs all the simulations of the batch concurrently (each one on a single thread), then prints one row
+// (TSV, in the order of runs) with the totals of every run
+template<typename C>
+int runBatch(const vector<SimulationRun>& runs) {
+    vector<SimulationResult> results = simulateRuns<C>(runs, NUM_THREADS);
 
-template<bool wall, int fish_sense_dist>
-bool operator< (const Food<wall, fish_sense_dist> &left, const Food<wall, fish_sense_dist> &right)
-{
-    return left.id < right.id;
+    std::cout << "row\treplicate\tseed\tfish_eaten\tfood_eaten\n";
+    for (size_t i = 0; i < runs.size(); i++) {
+        std::cout << runs[i].row << '\t' << runs[i].replicate << '\t' << runs[i].seed << '\t'
+                  << results[i].fish_eaten << '\t' << results[i].food_eaten << '\n';
+    }
+    std::cout.flush();
+    return 0;
 }
 
-template<int fish_sense_dist, int fish_max_speed, int fish_fear_steps, 
-         int fish_dim_ellipse_x, int fish_dim_ellipse_y,  bool wall>
-class Fish {
+// reads newline-terminated lines from a file descriptor (stdin or a socket)
+class LineReader {
 public:
-    using Food_t = Food<wall, fish_sense_dist>;
-
-    // first Width, then Height
-    glm::vec2 pos;
-    glm::vec2 dir;
-    int id;
-    int fear_steps;
-    bool alive=true;
-
-    Fish(int id) {
-        this->id = id;
-        this->pos = getRandomPlace<WIDTH, HEIGHT>();
-        this->dir = getRandomDirection();
-        this->fear_steps = 0;
-    }
-
-    void step(
-        vector<Fish> & neighbours, 
-        vector<Food_t> & close_food,
-        const vector<glm::vec2>& sharks_pos, 
-        const vector<glm::vec2>& sharks_direction
-    ) {
-        // when it is dead, do nothing
-        if (!alive)
-            return;
-
-        // compute average angle, average position and average distance from neighbours
-        // avg angle for alignment, avg pos for cohesion, avg dist for separation
-
-        int N = 0;
-        float avg_sin = 0, avg_cos = 0;
-        glm::vec2 avg_p(0), avg_d(0);
-        for (auto n : neighbours) {
-            avg_p += n.pos;
-
-            // separation computation
-            if (n.id != this->id) {
-                glm::vec2 away = this->pos - n.pos;
-                away /= glm::length2(away);
-                avg_d += away;
-            }
-
-            // calculate the heading angle of the vector in the xy-plane
-            float angle = glm::atan(n.dir[1], n.dir[0]);
-
-            avg_sin += sin(angle);
-            avg_cos += cos(angle);
-            N++;
-        }
-        // divide everything by N (we want average values)
-        avg_sin /= (float)N, avg_cos /= (float)N, avg_p /= N, avg_d /= N;
-
-        // get angle from sin cos values
-        float avg_angle = atan2(avg_sin, avg_cos);
-        // add some random noise to the direction angle
-        std::mt19937 rng;
-        std::uniform_real_distribution<float> dist(-0.01, 0.01);
-        float noise = dist(rng);
-        avg_angle += noise;
-
-        // behaviour depends on if fish has a fear behaviour activated at the moment 
-        // momentum - consider previous direction as a base to add the forces
-        if (this->fear_steps > 0) {
-            this->dir = this->dir * FISH_FEAR_MOMENTUM_CONSTANT;
-        } else {
-            this->dir = this->dir * FISH_MOMENTUM_CONSTANT;
-        }
-        
-        // alignment force
-        glm::vec2 allignment_vec = glm::vec2(cos(avg_angle), sin(avg_angle));
-        allignment_vec *= ALIGNMENT_CONSTANT;
-        this->dir += allignment_vec;
-
-        // cohesion force
-        glm::vec2 cohesion_vec = avg_p - this->pos;
-        cohesion_vec *= COHESION_CONSTANT;
-        this->dir += cohesion_vec;
-
-        // separation force
-        glm::vec2 separation_vec = avg_d;
-        separation_vec *= SEPARATION_CONSTANT;
-        this->dir += separation_vec;
-
-        // TODO: food attraction force
-        // for now - go to closest food if there is some close by
-        glm::vec2 closest_food_pos(0);
-        float closest_food_dist = fish_sense_dist;
-        for (auto f : close_food) {
-            if (glm::distance(this->pos, f.pos) <= closest_food_dist) {
-                closest_food_pos = f.pos;
-                closest_food_dist = glm::distance(this->pos, f.pos);
-            }        
-        }
-        if (closest_food_dist < fish_sense_dist) { // only use food attraction if some food close by was found
-            glm::vec2 food_attraction_vec = closest_food_pos - this->pos;
-            food_attraction_vec /= glm::length(food_attraction_vec); // divide by magnitude
-            food_attraction_vec *= FOOD_ATTRACTION_CONSTANT;
-            this->dir += food_attraction_vec;
-        }
-
-        // repulse force from each shark
-        int i = 0;
-        bool near_shark = false;
-        for (auto & shark_pos: sharks_pos) {
-            glm::vec2 shark_mouth_position = getMouthFromCenter(shark_pos,sharks_direction[i]);
-
-            // add repulsive force from shark if it is near the fish
-            if (glm::distance(shark_mouth_position, this->pos) <= (float) fish_sense_dist) {
-                glm::vec2 shark_repulsion_vec = this->pos - shark_mouth_position;
-                shark_repulsion_vec /= glm::length(shark_repulsion_vec); // divide by magnitude
-                shark_repulsion_vec *= SHARK_REPULSION_CONSTANT;
-                this->dir += shark_repulsion_vec;
-
-                // activate the fear mode
-                this->fear_steps = fish_fear_steps;
-                near_shark = true;
-            }
-            i++;
-        }
-        if (!near_shark && this->fear_steps != 0) {
-            // decrease the number of steps in fear remaining
-            this->fear_steps--;
-        }
-
-        // wall repulsion, if it is enabled
-        if (wall) {
-            // add wall repulsion vector (from the nearest wall point)
-            glm::vec2 nearest_wall = getNearestBorderPoint<WIDTH, HEIGHT>(this->pos);
-            if (glm::distance(nearest_wall, this->pos) <= (float)fish_sense_dist) {
-                glm::vec2 wall_repulsion_vector = this->pos - nearest_wall;
-                wall_repulsion_vector /= glm::length(wall_repulsion_vector); // divide by its magnitude
-                wall_repulsion_vector *= 2; // make it bit larger to avoid clustering in corners
-                this->dir += wall_repulsion_vector;
-            }
-
-            // cant go through the wall
-            if (isFishOutOfBorders<WIDTH, HEIGHT>(this->pos + this->dir)) {
-                this->dir *= -1;
+    explicit LineReader(int fd) : fd(fd) {}
+
+    // false at the end of the input (a last line without a newline is still returned)
+    bool next(string& line) {
+        while (true) {
+            size_t newline = buffer.find('\n');
+            if (newline != string::npos) {
+                line = buffer.substr(0, newline);
+                buffer.erase(0, newline + 1);
+                return true;
             }
-        }
-
-        // check if fish does not exceed its max speed
-        if (glm::length(this->dir) > fish_max_speed) {
-            this->dir /= (glm::length(this->dir) / fish_max_speed);
-        }
-
-        // check if fish dimensions does not overlap with other fish
-        // however, only count this if there is a chance of overlap at all 
-        for (auto &n: neighbours){
-            // check if there is even a chance for overlap (in radius of larger fish dimension, with some margin)
-            if (glm::length(this->pos - n.pos) > FISH_LARGER_DIM + 5) {
+            char chunk[4096];
+            ssize_t n = ::read(fd, chunk, sizeof(chunk));
+            if (n < 0 && errno == EINTR)
                 continue;
+            if (n <= 0) {
+                line = std::move(buffer);
+                buffer.clear();
+                return !line.empty();
             }
-            float ovrlpDistance = ellipsesOverlapDistance<fish_dim_ellipse_x, fish_dim_ellipse_y, fish_dim_ellipse_x, fish_dim_ellipse_y>(
-                    this->pos, this->dir, n.pos, n.dir);
-            if (ovrlpDistance > 0) {
-                // change the direction
-                this->dir *= -0.25; // TODO: FIXME?
-            }
+            buffer.append(chunk, n);
         }
-
-        // TODO: adjust the change of direction possible and its momentum (magnitude) - scale direction while turning - if significant turn, there is decrease of momentum
-
-
-        // update fish position
-        this->pos += this->dir;
     }
-};
 
+private:
+    int fd;
+    string buffer;
+};
 
-template<int shark_sense_dist, int shark_max_speed, int shark_kill_radius,
-        int fish_sense_dist, int fish_max_speed, int fish_fear_steps, 
-        int fish_dim_ellipse_x, int fish_dim_ellipse_y, bool wall>
-class Shark {
+// one client of the server: requests come from `in_fd`, results go to `out_fd` (the same fd for a socket)
+// results are written by the worker threads as the runs finish, whole lines at a time
+class ServeClient {
 public:
-    using Fish_t = Fish<fish_sense_dist, fish_max_speed, fish_fear_steps, fish_dim_ellipse_x, fish_dim_ellipse_y, wall>;
-
-    // first Width, then Height
-    glm::vec2 pos;
-    glm::vec2 dir;
-    int id;
-
-    Shark(int id) {
-        this->id = id;
-        this->pos = getRandomPlace<WIDTH, HEIGHT>();
-        this->dir = getRandomDirection();
-    };
+    ServeClient(int in_fd, int out_fd, bool owns_fd) : in_fd(in_fd), out_fd(out_fd), owns_fd(owns_fd) {}
 
-    void step(vector<Fish_t> & visible_neighbours) {
-
-        // compute the average position of neighbouring fish
-        int N = 0;
-        auto avg_p = glm::vec2(0.0f);
-        for (Fish_t n : visible_neighbours) {
-            avg_p += n.pos;
-            N++;
-        }
-
-        // momentum - consider previous direction as a base to add the forces to
-        this->dir = this->dir * SHARK_MOMENTUM_CONSTANT;
-
-        if (N == 0) {
-            // if no visible_neighbours, shift randomly for a bit
-            std::random_device rd;
-            std::mt19937 gen(rd());
-            std::uniform_real_distribution<float> dis(-0.5f, 0.5f);
-            float avg_angle = dis(gen);
-            auto random_vec = glm::vec2(cos(avg_angle), sin(avg_angle));
-            random_vec *= SHARK_SEARCH_CONSTANT;
-            this->dir += random_vec;
-        } else {
-            // otherwise go for the average position of neighbouring fish
-            avg_p /= static_cast<float>(N);
-            glm::vec2 hunt_vector = avg_p - this->pos;
-            hunt_vector /= glm::length2(hunt_vector); // divide by its squared magnitude
-            hunt_vector *= SHARK_HUNT_CONSTANT;
-            this->dir += hunt_vector;
-        }
+    // the socket stays open until the last run of the client has answered
+    ~ServeClient() {
+        if (owns_fd)
+            ::close(in_fd);
+    }
 
-        // wall repulsion, if it is enabled
-        if (wall) {
-            // add wall repulsion vector
-            glm::vec2 nearest_wall = getNearestBorderPoint<WIDTH, HEIGHT>(this->pos);
-            if (glm::distance(nearest_wall, this->pos) <= (float)shark_sense_dist) {
-                glm::vec2 wall_repulsion_vec = this->pos - nearest_wall;
-                wall_repulsion_vec /= glm::length(wall_repulsion_vec); // divide by its magnitude
-                wall_repulsion_vec *= 2;
-                this->dir += wall_repulsion_vec;
-            }
+    const int in_fd, out_fd;
 
-            // cant go trough wall
-            if (isFishOutOfBorders<WIDTH, HEIGHT>(this->pos + this->dir)) {
-                this->dir *= -1;
-            }
-        }
+    // the results can no longer be written (the socket or the read end of the output was closed)
+    bool gone() const { return is_gone; }
 
-        // ensure max speed of a shark
-        if (glm::length(this->dir) > shark_max_speed) {
-            this->dir /= (glm::length(this->dir) / shark_max_speed);
+    void writeLine(const string& line) {
+        string data = line + '\n';
+        std::lock_guard<std::mutex> lock(write_mutex);
+        size_t written = 0;
+        while (!is_gone && written < data.size()) {
+            ssize_t n = ::write(out_fd, data.data() + written, data.size() - written);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                is_gone = true; // the client is gone, its results are dropped
+            else
+                written += n;
         }
-
-        // update position
-        this->pos += this->dir;
     }
-};
-
 
-template<int width, int height, int num_steps, int num_fish, int num_sharks, int num_food,
-        int fish_sense_dist, int shark_sense_dist, int shark_kill_radius,
-        int fish_max_speed, int shark_max_speed, 
-        int fish_fear_steps, int fish_dim_ellipse_x, int fish_dim_ellipse_y, 
-        int shark_blind_angle_deg, bool wall>
-class Scene {
 private:
+    const bool owns_fd;
+    std::mutex write_mutex;
+    std::atomic<bool> is_gone = false;
+};
 
-    using Fish_t = Fish<fish_sense_dist, fish_max_speed, fish_fear_steps, fish_dim_ellipse_x, fish_dim_ellipse_y, wall>;
-    using Shark_t = Shark<shark_sense_dist, shark_max_speed, shark_kill_radius, fish_sense_dist, fish_max_speed, fish_fear_steps, fish_dim_ellipse_x, fish_dim_ellipse_y, wall>;
-    using Food_t = Food<wall, fish_sense_dist>;
-
-    vector<Fish_t> swarm;
-    vector<Shark_t> sharks;
-    set<Food_t> food_set;
-    int next_food_index; // when inserting new food, use this free (not used) index
-
-public:
-    Scene() {
-        // generate fish
-        for (int i=0; i < num_fish; i ++) {
-            swarm.emplace_back(Fish_t(i));
+// answers the requests of one client until the end of its input, or until its results cannot be written
+// a request is one line "<id> <fish-momentum> <alignment> <cohesion> <separation> <shark-repulsion>
+// <food-attraction> [<seed>]" (separated by spaces or tabs), it is run `REPLICATES` times with consecutive seeds
+// (from the given one, or unique for the whole server); every run answers with a line
+// "<id>\t<replicate>\t<seed>\t<fish_eaten>\t<food_eaten>" as soon as it finishes, invalid requests with
+// "<id>\terror\t<reason>"
+template<typename C>
+void serveClient(std::shared_ptr<ServeClient> client, WorkerPool& pool, std::atomic<uint64_t>& next_seed) {
+    LineReader reader(client->in_fd);
+    string line;
+    while (!client->gone() && reader.next(line)) {
+        std::istringstream request(line);
+        string id;
+        if (!(request >> id))
+            continue; // empty line
+
+        ModelParams params = ModelParams::fromGlobals();
+        if (!(request >> params.fish_momentum >> params.alignment >> params.cohesion >> params.separation
+                      >> params.shark_repulsion >> params.food_attraction)) {
+            client->writeLine(id + "\terror\texpected 6 parameters");
+            continue;
         }
+        params.fish_fear_momentum = params.fish_momentum * 1.1;
 
-        // generate sharks
-        for (int i = 0; i < num_sharks; i++) {
-            sharks.emplace_back(Shark_t(i));
+        uint64_t seed;
+        if (!(request >> seed)) {
+            if (!request.eof()) {
+                client->writeLine(id + "\terror\tinvalid seed");
+                continue;
+            }
+            seed = next_seed.fetch_add(REPLICATES);
         }
 
-        // generate food
-        for (int i = 0; i < num_food; i++) {
-            food_set.insert(Food_t(i));
+        for (int r = 0; r < REPLICATES; r++) {
+            pool.submit([client, id, r, params, seed]() {
+                if (client->gone())
+                    return; // nobody would read the result
+#ifdef _OPENMP
+                omp_set_num_threads(1); // the runs themselves are what runs in parallel
+#endif
+                Scene<C> scene(params, seed + r);
+                auto result = scene.run();
+                client->writeLine(id + '\t' + std::to_string(r) + '\t' + std::to_string(seed + r) + '\t' +
+                                  std::to_string(result.fish_eaten) + '\t' + std::to_string(result.food_eaten));
+            });
         }
-        next_food_index = num_food;
     }
+}
 
-    // get neighbors for prey fish up to certain distance
-    vector<Fish_t> getFishNeighbours(Fish_t fish) {
-        vector<Fish_t> neighbours;
-
-        for (auto f: swarm){
-            if (f.alive && glm::distance(fish.pos, f.pos)<= (float)fish_sense_dist) {
-                neighbours.push_back(f);
-            }
+// long-lived evaluation server, requests are run on a pool of `NUM_THREADS` workers (see `serveClient`)
+// with endpoint "-" it serves stdin/stdout until the end of the input, otherwise it listens on a UNIX domain
+// socket of that path and serves any number of clients at once, until it is killed
+template<typename C>
+int runServer(const string& endpoint) {
+    int num_threads = NUM_THREADS > 0 ? NUM_THREADS : (int)std::thread::hardware_concurrency();
+    WorkerPool pool(num_threads);
+    std::atomic<uint64_t> next_seed = SEED;
+    // a client (or the reader of stdout) that goes away before its results are written must not kill the server,
+    // the write fails instead (see `ServeClient::writeLine`)
+    std::signal(SIGPIPE, SIG_IGN);
+
+    if (endpoint == "-") {
+        auto client = std::make_shared<ServeClient>(STDIN_FILENO, STDOUT_FILENO, false);
+        serveClient<C>(client, pool, next_seed);
+        pool.wait();
+        if (client->gone()) {
+            std::cerr << "serve: stdout was closed, the remaining requests were dropped" << std::endl;
+            return 1;
         }
-
-        return neighbours;
+        return 0;
     }
 
-    // get food for prey fish which is up to certain distance
-    vector<Food_t> getNeighbouringFood(Fish_t fish) {
-        vector<Food_t> food_close_by;
-
-        for (auto f: food_set){
-            if (!f.eaten && glm::distance(fish.pos, f.pos)<= (float)fish_sense_dist) {
-                food_close_by.push_back(f);
-            }
-        }
-
-        return food_close_by;
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if (endpoint.size() >= sizeof(address.sun_path)) {
+        std::cerr << "serve: socket path is too long" << std::endl;
+        return 1;
     }
+    std::strcpy(address.sun_path, endpoint.c_str());
 
-    bool isInBlindSpot(glm::vec2 fishPos, glm::vec2 sharkPos, glm::vec2 sharkDir) {
-        // Calculate the vector from the shark to the fish
-        glm::vec2 sharkToFish = fishPos - sharkPos;
-
-        // Calculate the angle between the shark's direction and the vector from the shark to the fish
-        float angle = glm::angle(sharkDir, sharkToFish);
-        
-        // Convert the blind spot angle from degrees to radians
-        float blindSpotAngleRad = glm::radians((float)shark_blind_angle_deg);
-
-        // If the angle is greater than or equal to the blind spot angle, the fish is in the blind spot
-        return angle >= glm::pi<float>() - blindSpotAngleRad / 2;
+    int server_fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (server_fd < 0) {
+        std::cerr << "serve: cannot create a socket: " << std::strerror(errno) << std::endl;
+        return 1;
     }
-
-    // get neighbors for predator shark up to certain distance
-    vector<Fish_t> getFishPrey(const Shark_t& s) {
-        vector<Fish_t> neighbours;
-
-        for (const auto& f: swarm){
-            if (f.alive &&
-                glm::distance(s.pos, f.pos)<= (float)shark_sense_dist &&
-                !isInBlindSpot(f.pos, s.pos, s.dir)) {
-                    neighbours.push_back(f);
-            }
+    // a socket left by a previous server is replaced, any other file is kept
+    struct stat existing;
+    if (::lstat(endpoint.c_str(), &existing) == 0) {
+        if (!S_ISSOCK(existing.st_mode)) {
+            std::cerr << "serve: " << endpoint << " exists and is not a socket" << std::endl;
+            return 1;
         }
-
-        return neighbours;
+        ::unlink(endpoint.c_str());
     }
-
-    // mark eaten fish as dead and return them
-    vector<Fish_t> getEatenFish(const Shark_t& s) {
-        vector<Fish_t> eatenFish;
-        for (auto& f: swarm) {
-            if (f.alive && glm::distance(getMouthFromCenter(s.pos, s.dir), f.pos) <= (float)shark_kill_radius) {
-                f.alive = false;
-                eatenFish.push_back(f);
-            }
-        }
-        return eatenFish;
+    if (::bind(server_fd, (sockaddr*)&address, sizeof(address)) < 0 || ::listen(server_fd, 16) < 0) {
+        std::cerr << "serve: cannot listen on " << endpoint << ": " << std::strerror(errno) << std::endl;
+        return 1;
     }
-
-    // mark eaten food pieces and return them
-    vector<Food_t> getEatenFood(const Fish_t& fish) {
-        vector<Food_t> eatenFood;
-        for (auto& f: food_set) {
-            if (!f.eaten && glm::distance(fish.pos, f.pos) <= (float)fish_dim_ellipse_x) {
-                f.eaten = true;
-                eatenFood.push_back(f);
-            }
+    while (true) {
+        int client_fd = ::accept(server_fd, nullptr, nullptr);
+        if (client_fd < 0) {
+            if (errno == EINTR)
+                continue;
+            std::cerr << "serve: accept failed: " << std::strerror(errno) << std::endl;
+            return 1;
         }
-        return eatenFood;
+        auto client = std::make_shared<ServeClient>(client_fd, client_fd, true);
+        std::thread([client, &pool, &next_seed]() { serveClient<C>(client, pool, next_seed); }).detach();
     }
+}
 
-    // Function to wrap outer boundaries of the canvas using "cyclic" boundaries
-    // gets a point, returns either same point, or point on opposite side if it "crosses" boundary
-    void wrap(float& x, float& y) {
-        if (x < 0) x += width;
-        if (y < 0) y += height;
-        if (x >= width) x -= width;
-        if (y >= height) y -= height;
-    }
-
-    void simulate(const string& output_filepath) {
-        nlohmann::json log;
-        vector<nlohmann::json> steps_j;
-        size_t fish_eaten_total = 0;
-        size_t food_eaten_total = 0;
-
-        for (int i = 0; i < num_steps; i++){
-            if (debug) std::cout << "step #" << i;
-
-            // food drifting
-            for (auto& f: food_set) {
-                f.step();
-                wrap(f.pos[0], f.pos[1]);
-            }
-
-            // move fish
-            size_t eaten_food_counter = 0;
-            for (auto& f: swarm) {
-                vector<Fish_t> neighbours = getFishNeighbours(f);
-                vector<Food_t> food_close_by = getNeighbouringFood(f);
-                vector<glm::vec2> sharks_position;
-                std::transform(sharks.begin(), sharks.end(), std::back_inserter(sharks_position), [](const Shark_t s){
-                    return s.pos;
-                });
-                vector<glm::vec2> sharks_direction;
-                std::transform(sharks.begin(), sharks.end(), std::back_inserter(sharks_direction), [](const Shark_t s){
-                    return s.dir;
-                });
-                f.step(neighbours, food_close_by, sharks_position, sharks_direction);
-                wrap(f.pos[0], f.pos[1]);
-
-                // remove and count eaten food, add new food
-                vector<Food_t> eaten_food = getEatenFood(f);
-                eaten_food_counter += eaten_food.size();
-                for (auto& f: eaten_food) {
-                    food_set.erase(f);
-                    food_set.insert(Food_t(next_food_index));
-                    next_food_index++;
-                }
-            }
-
-            // handle sharks
-            size_t eaten_fish_counter = 0;
-            for (auto &s: this->sharks) {
-                // move shark
-                vector<Fish_t> prey_neighbours = getFishPrey(s);
-                s.step(prey_neighbours);
-                wrap(s.pos[0], s.pos[1]);
-
-                // label and count eaten fish
-                vector<Fish_t> eaten_fish = getEatenFish(s);
-                eaten_fish_counter += eaten_fish.size();
-            }
-            if (eaten_fish_counter > 0) {
-                if (debug) std::cout << " [" << eaten_fish_counter << " fish eaten]";
-                if (eaten_food_counter > 0) {
-                    if (debug) std::cout << " [" << eaten_food_counter << " food eaten]" << endl;
-                    food_eaten_total += eaten_food_counter;
-                } else {
-                    if (debug) std::cout << endl;
-                }
-                fish_eaten_total += eaten_fish_counter;
-            } else if (eaten_food_counter > 0) {
-                if (debug) std::cout << "               " << " [" << eaten_food_counter << " food eaten]" << endl;
-                food_eaten_total += eaten_food_counter;
-            } else {
-                if (debug) std::cout << endl;
-            }
-            if (debug) steps_j.push_back(logStepToJson(eaten_food_counter));
+// runs the simulation (or one of the reports) on a scene with configuration `C`, returns the exit code
+template<typename C>
+int runScene() {
+    // setup Scene
+    Scene<C> scene(ModelParams::fromGlobals(), SEED);
+
+    if (FAST_MATH_REPORT) {
+        // error of the approximate inverse square root itself, over a wide range of inputs
+        float max_rel_error = 0;
+        for (float x = 1e-6f; x < 1e6f; x *= 1.001f) {
+            float exact = 1.0f / std::sqrt(x);
+            max_rel_error = std::max(max_rel_error, std::abs(fastInverseSqrt(x) - exact) / exact);
         }
 
-        // always print this
-        std::cout << "TOTAL FISH EATEN: " << fish_eaten_total << endl;
-        std::cout << "TOTAL FOOD EATEN: " << food_eaten_total << endl;
-
-        if (debug) {
-            // complete json object
-            log = {
-                    {"scene",
-                        {
-                            {"width", width},
-                            {"height", height}
-                        }
-                    },
-                    {"stepsTotal", num_steps},
-                    {"fish_dim_x", fish_dim_ellipse_x},
-                    {"fish_dim_y", fish_dim_ellipse_y},
-                    {"shark_dim_x", SHARK_DIM_ELLIPSE_X},
-                    {"shark_dim_y", SHARK_DIM_ELLIPSE_Y},
-                    {"shark_kill_radius", SHARK_KILL_RADIUS},
-                    {"shark_sense_dist", SHARK_SENSE_DIST},
-                    {"shark_blind_angle_back", SHARK_BLIND_ANGLE_DEG},
-                    {"steps", steps_j},
-            };
-
-            // save log to json file -- must not forget to delete previous content
-            std::ofstream file(output_filepath, std::ofstream::out | std::ofstream::trunc);
-            file << log.dump(-1);
-            file.close();
+        // deviation of the whole fish update, evaluated along a reference run
+        // (the maximum is mostly a collision that reversed the fish in one update and not in the other)
+        FAST_MATH = false;
+        float max_deviation = 0;
+        double sum_deviation = 0;
+        size_t count = 0;
+        for (int i = 0; i < NUM_STEPS; i++) {
+            auto deviation = scene.fastMathDeviation();
+            max_deviation = std::max(max_deviation, deviation.max);
+            sum_deviation += deviation.sum;
+            count += deviation.count;
+            scene.advance();
         }
+        std::cout << "FAST MATH MAX RELATIVE ERROR OF 1/SQRT: " << max_rel_error << endl;
+        std::cout << "FAST MATH MAX DIRECTION DEVIATION: " << max_deviation << endl;
+        std::cout << "FAST MATH MEAN DIRECTION DEVIATION: " << (count > 0 ? sum_deviation / count : 0) << endl;
+        return 0;
     }
 
-    nlohmann::json logStepToJson(int eaten_food_counter) {
-        // create an empty JSON object
-        nlohmann::json j;
-
-        // create json object to each fish
-        int deadFish = 0;
-        vector<nlohmann::json> swarm_j;
-        for (auto & f: this->swarm) {
-            nlohmann::json fish_j;
-            float direction_radians = atan2(f.dir[0], f.dir[1]);
-            fish_j = {
-                    {"id", f.id},
-                    {"x", (int)f.pos[0]},
-                    {"y", (int)f.pos[1]},
-                    {"dir", direction_radians},
-                    {"alive", f.alive},
-            };
-            swarm_j.emplace_back(fish_j);
-
-            if (!f.alive)
-                deadFish ++;
+    if (SIMD_REPORT) {
+        // deviation of the fish update using the selected kernel, evaluated along a run using it
+        float max_deviation = 0;
+        for (int i = 0; i < NUM_STEPS; i++) {
+            max_deviation = std::max(max_deviation, scene.simdDeviation());
+            scene.advance();
         }
+        std::cout << "SIMD MAX DIRECTION DEVIATION: " << max_deviation << endl;
+        return 0;
+    }
 
-        // create json object to each shark
-        vector<nlohmann::json> sharks_j;
-        for (auto &s: this->sharks) {
-            nlohmann::json shark_j;
-            float direction_radians = atan2(s.dir[0], s.dir[1]);
-            shark_j = {
-                    {"id", s.id},
-                    {"x", s.pos[0]},
-                    {"y", s.pos[1]},
-                    {"dir", direction_radians},
-            };
-            sharks_j.emplace_back(shark_j);
+    if (MEAN_FIELD_REPORT) {
+        // deviation of the mean-field fish update, evaluated along an exact run
+        // (the maximum is mostly a collision that reversed the fish in one update and not in the other)
+        int resolution = MEAN_FIELD;
+        float max_deviation = 0;
+        double sum_deviation = 0;
+        size_t count = 0, close_neighbours = 0;
+        for (int i = 0; i < NUM_STEPS; i++) {
+            auto deviation = scene.meanFieldDeviation();
+            max_deviation = std::max(max_deviation, deviation.max);
+            sum_deviation += deviation.sum;
+            count += deviation.count;
+            close_neighbours += deviation.close_neighbours;
+            MEAN_FIELD = 0;
+            scene.advance();
+            MEAN_FIELD = resolution;
         }
-
-        // create json object for food
-        vector<nlohmann::json> food_j;
-        for (auto &f: this->food_set) {
-            nlohmann::json f_j;
-//            float direction_radians = atan2(s.dir[0], s.dir[1]);
-            f_j = {
-                    {"id", f.id},
-                    {"x", f.pos[0]},
-                    {"y", f.pos[1]},
-//                    {"dir", direction_radians},
-            };
-            food_j.emplace_back(f_j);
+        std::cout << "MEAN FIELD MAX DIRECTION DEVIATION: " << max_deviation << endl;
+        std::cout << "MEAN FIELD MEAN DIRECTION DEVIATION: " << (count > 0 ? sum_deviation / count : 0) << endl;
+        std::cout << "MEAN FIELD CLOSE NEIGHBOURS PER FISH: " << (count > 0 ? (double)close_neighbours / count : 0) << endl;
+
+        // whole runs from the same seed, the outcome of the approximate one and the time it saves
+        for (int mean_field : {0, resolution}) {
+            MEAN_FIELD = mean_field;
+            auto start = std::chrono::steady_clock::now();
+            SimulationResult result = Scene<C>(ModelParams::fromGlobals(), SEED).run();
+            std::chrono::duration<double> seconds = std::chrono::steady_clock::now() - start;
+            std::cout << (mean_field > 0 ? "MEAN FIELD" : "EXACT") << " RUN: fish eaten " << result.fish_eaten
+                      << ", food eaten " << result.food_eaten << ", " << seconds.count() << " s" << endl;
         }
-
-        // add each attribute to the JSON object
-        j = {
-                {"sharks", sharks_j},
-                {"swarm", swarm_j},
-                {"food", food_j},
-                {"deadFish", deadFish},
-                {"eatenFood", eaten_food_counter},
-        };
-
-        return j;
+        return 0;
     }
-};
+
+    // simulation
+    scene.simulate(LOG_FILEPATH);
+    return 0;
+}
 
 int main(int argc, char** argv) {
     // parse input parameters at the beginning
     parse_arguments(argc, argv);
+#ifdef _OPENMP
+    if (NUM_THREADS > 0)
+        omp_set_num_threads(NUM_THREADS);
+#endif
     // adjust fear momentum based on momentum parameter provided as argument
     FISH_FEAR_MOMENTUM_CONSTANT = FISH_MOMENTUM_CONSTANT * 1.1;
 
+    // if help was printed, end program
+    if (help)
+        return 0;
+
+    // the spawns take random places modulo the size, and the grids are made of cells as wide as the sense distances
+    if (WIDTH <= 0 || HEIGHT <= 0) {
+        std::cerr << "width and height must be positive" << std::endl;
+        return 1;
+    }
+    if (FISH_SENSE_DIST <= 0 || SHARK_SENSE_DIST <= 0) {
+        std::cerr << "fish and shark sense distances must be positive" << std::endl;
+        return 1;
+    }
+    if (NUM_FISH < 0 || NUM_SHARKS < 0 || NUM_FOOD < 0) {
+        std::cerr << "number of fish, sharks and food must not be negative" << std::endl;
+        return 1;
+    }
+
     // check if fish sense dist is bigger than dimensions of the fish (represented as ellipse)
     assert(max(FISH_DIM_ELLIPSE_X, FISH_DIM_ELLIPSE_Y) < FISH_SENSE_DIST &&
            "fish sense dist must be bigger than dimensions of the fish (represented as ellipse)");
 
-    // if help was printed, end program
-    if (help)
-        return 0;
+    neighbourSums = selectNeighbourSumsKernel(SIMD);
+    if (!neighbourSums) {
+        std::cerr << "SIMD kernel '" << SIMD << "' is not supported on this CPU" << std::endl;
+        return 1;
+    }
+    if (SPATIAL_INDEX != "grid" && SPATIAL_INDEX != "quadtree" && SPATIAL_INDEX != "auto") {
+        std::cerr << "spatial index must be grid, quadtree or auto" << std::endl;
+        return 1;
+    }
+    if (FISH_NEIGHBOURS < 0 || FISH_NEIGHBOURS > MAX_FISH_NEIGHBOURS) {
+        std::cerr << "number of fish neighbours must be between 0 and " << MAX_FISH_NEIGHBOURS << std::endl;
+        return 1;
+    }
+    // the report compares the resolution 4 unless another one is given
+    if (MEAN_FIELD_REPORT && MEAN_FIELD == 0)
+        MEAN_FIELD = 4;
+    if (MEAN_FIELD < 0 || (MEAN_FIELD > 0 && FISH_NEIGHBOURS > 0)) {
+        std::cerr << "mean field resolution must not be negative, and it cannot be combined with fish neighbours" << std::endl;
+        return 1;
+    }
+    // the close neighbours have to include all the fish a fish can collide with (see `Fish::resolveCollisions`)
+    if (MEAN_FIELD > 0 && (MEAN_FIELD_CLOSE < std::max(FISH_DIM_ELLIPSE_X, FISH_DIM_ELLIPSE_Y) + 5 ||
+                           MEAN_FIELD_CLOSE > FISH_SENSE_DIST)) {
+        std::cerr << "mean field close distance must be between the larger fish dimension + 5 and the sense distance" << std::endl;
+        return 1;
+    }
+    if (VERLET_SKIN < 0 || SORT_EVERY < 0) {
+        std::cerr << "verlet skin and sort interval must not be negative" << std::endl;
+        return 1;
+    }
+
+    if ((LOG_FORMAT != "json" && LOG_FORMAT != "binary") || (LOG_HEADING_BITS != 8 && LOG_HEADING_BITS != 16) ||
+        LOG_KEYFRAME_INTERVAL < 1 || LOG_QUEUE_SIZE < 1 || LOG_EVERY < 1 || LOG_FROM < 0 ||
+        RECORD_BEFORE < 0 || RECORD_AFTER < 0) {
+        std::cerr << "log: format must be json or binary, heading bits 8 or 16, key frame interval, queue size and "
+                     "step interval positive, first step and flight recorder steps not negative" << std::endl;
+        return 1;
+    }
 
     // =============================
 
+    // batch and server modes only print the results of the runs
+    if (!BATCH_FILEPATH.empty()) {
+        vector<SimulationRun> runs;
+        bool valid;
+        if (BATCH_FILEPATH == "-") {
+            valid = readBatch(std::cin, runs);
+        } else {
+            std::ifstream batch_file(BATCH_FILEPATH);
+            if (!batch_file) {
+                std::cerr << "batch: cannot open " << BATCH_FILEPATH << std::endl;
+                return 1;
+            }
+            valid = readBatch(batch_file, runs);
+        }
+        if (!valid)
+            return 1;
+        return dispatchConfig(PrecompiledConfigs{}, [&runs]<typename C>() { return runBatch<C>(runs); });
+    }
+
+    if (!SERVE_ENDPOINT.empty()) {
+        return dispatchConfig(PrecompiledConfigs{}, []<typename C>() { return runServer<C>(SERVE_ENDPOINT); });
+    }
+
     if (debug) {
         // print all params in order to have them logged
         std::cout << "Parameter values:" << std::endl << std::endl;
@@ -825,7 +602,15 @@ int main(int argc, char** argv) {
         std::cout << ">SHARK_DIM_ELLIPSE_Y: " << SHARK_DIM_ELLIPSE_Y << std::endl;
         std::cout << ">SHARK_BLIND_ANGLE_DEG: " << SHARK_BLIND_ANGLE_DEG << std::endl;
         std::cout << ">WALL: " << WALL << std::endl;
+        std::cout << ">PRECOMPILED CONFIG: "
+                  << dispatchConfig(PrecompiledConfigs{}, []<typename C>() { return !std::is_same_v<C, RuntimeConfig>; })
+                  << std::endl;
+        std::cout << ">SYNC_UPDATE: " << SYNC_UPDATE << std::endl;
+        std::cout << ">SEED: " << SEED << std::endl;
+        std::cout << ">NUM_THREADS: " << maxThreads() << std::endl;
+        std::cout << ">SIMD: " << SIMD << std::endl;
         std::cout << ">LOG_FILEPATH: " << LOG_FILEPATH << std::endl;
+        std::cout << ">LOG_FORMAT: " << LOG_FORMAT << std::endl;
 
         std::cout << std::endl << "Simulation starts." << std::endl;
     }
@@ -833,15 +618,10 @@ int main(int argc, char** argv) {
     // Start measuring time
     std::clock_t start = std::clock();
 
-    // setup Scene
-    Scene scene = Scene<WIDTH, HEIGHT, NUM_STEPS, NUM_FISH, NUM_SHARKS, NUM_FOOD,
-            FISH_SENSE_DIST, SHARK_SENSE_DIST, SHARK_KILL_RADIUS,
-            FISH_MAX_SPEED, SHARK_MAX_SPEED, 
-            FISH_FEAR_CONSTANT, FISH_DIM_ELLIPSE_X, FISH_DIM_ELLIPSE_Y, 
-            SHARK_BLIND_ANGLE_DEG, WALL>();
-
-    // simulation
-    scene.simulate(LOG_FILEPATH);
+    // setup Scene specialized for the given parameters (if they are common), and run it
+    int result = dispatchConfig(PrecompiledConfigs{}, []<typename C>() { return runScene<C>(); });
+    if (result != 0)
+        return result;
 
     // Stop measuring time
     std::clock_t end = std::clock();
@@ -0,0 +1,532 @@
+// Python module running the simulations in-process, built from the same engine as the simulator binary
+//
+//   import fish_simulation
+//   fish_simulation.simulate(params, seed=None, replicates=1, threads=0)
+//   fish_simulation.simulate_population(population, seed=None, replicates=1, threads=0)
+//
+// `params` are the optimizable parameters, either a sequence in the order of the evolution's individual
+// (fish momentum, alignment, cohesion, separation, shark repulsion, food attraction) or a dict with these names
+// ("fish_momentum", ...), missing parameters keep their defaults; the fixed parameters are the defaults
+// every run gives a dict {"replicate", "seed", "fish_eaten", "food_eaten"}, `simulate` returns the list of runs
+// of one parameter vector, `simulate_population` a list of such lists (runs get consecutive seeds, as in batch mode)
+// the GIL is released while the simulations run on native threads (`threads`, 0 means all cores)
+//
+//   sim = fish_simulation.Simulation(params, seed=None, steps=NUM_STEPS)
+//   sim.run(steps=None, trajectory=None)
+//   numpy.asarray(sim.fish_x), sim.fish_alive, sim.fish_eaten, ...
+//
+// `Simulation` is one scene stepped from Python, its state (positions, directions, alive masks) and per-step
+// counters are memoryviews reading the engine storage directly, so numpy.asarray() of them does not copy
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include "simulation.hpp"
+
+static const std::pair<const char*, float ModelParams::*> PARAM_NAMES[] = {
+        {"fish_momentum", &ModelParams::fish_momentum},
+        {"alignment", &ModelParams::alignment},
+        {"cohesion", &ModelParams::cohesion},
+        {"separation", &ModelParams::separation},
+        {"shark_repulsion", &ModelParams::shark_repulsion},
+        {"food_attraction", &ModelParams::food_attraction},
+};
+static constexpr Py_ssize_t NUM_PARAMS = sizeof(PARAM_NAMES) / sizeof(PARAM_NAMES[0]);
+
+// fills `params` from a sequence or a dict, returns false with a Python exception set if it is not valid
+static bool parseParams(PyObject* obj, ModelParams& params) {
+    params = ModelParams::fromGlobals();
+
+    if (PyDict_Check(obj)) {
+        PyObject* key;
+        PyObject* value;
+        Py_ssize_t pos = 0;
+        while (PyDict_Next(obj, &pos, &key, &value)) {
+            const char* name = PyUnicode_AsUTF8(key);
+            if (!name)
+                return false;
+            auto param = std::find_if(std::begin(PARAM_NAMES), std::end(PARAM_NAMES),
+                                      [&](const auto& p) { return std::strcmp(p.first, name) == 0; });
+            if (param == std::end(PARAM_NAMES)) {
+                PyErr_Format(PyExc_KeyError, "unknown parameter '%s'", name);
+                return false;
+            }
+            double v = PyFloat_AsDouble(value);
+            if (v == -1.0 && PyErr_Occurred())
+                return false;
+            params.*(param->second) = (float)v;
+        }
+    } else {
+        PyObject* seq = PySequence_Fast(obj, "parameters must be a sequence or a dict");
+        if (!seq)
+            return false;
+        Py_ssize_t n = PySequence_Fast_GET_SIZE(seq);
+        if (n > NUM_PARAMS) {
+            Py_DECREF(seq);
+            PyErr_Format(PyExc_ValueError, "expected at most %zd parameters, got %zd", NUM_PARAMS, n);
+            return false;
+        }
+        for (Py_ssize_t i = 0; i < n; i++) {
+            double v = PyFloat_AsDouble(PySequence_Fast_GET_ITEM(seq, i));
+            if (v == -1.0 && PyErr_Occurred()) {
+                Py_DECREF(seq);
+                return false;
+            }
+            params.*(PARAM_NAMES[i].second) = (float)v;
+        }
+        Py_DECREF(seq);
+    }
+
+    // as for the CLI arguments, fear momentum follows the momentum
+    params.fish_fear_momentum = params.fish_momentum * 1.1;
+    return true;
+}
+
+// seed given from Python, or a random one for None
+static bool parseSeed(PyObject* obj, uint64_t& seed) {
+    if (obj == Py_None) {
+        std::random_device rd;
+        seed = ((uint64_t)rd() << 32) | rd();
+        return true;
+    }
+    seed = PyLong_AsUnsignedLongLong(obj);
+    return !PyErr_Occurred();
+}
+
+// runs `replicates` simulations of every parameter vector, returns a list (per vector) of lists of run dicts
+static PyObject* simulateVectors(const vector<ModelParams>& vectors, PyObject* seed_obj, int replicates, int threads) {
+    if (replicates < 1) {
+        PyErr_SetString(PyExc_ValueError, "replicates must be at least 1");
+        return nullptr;
+    }
+
+    uint64_t seed;
+    if (!parseSeed(seed_obj, seed))
+        return nullptr;
+
+    vector<SimulationRun> runs;
+    for (size_t row = 0; row < vectors.size(); row++) {
+        for (int r = 0; r < replicates; r++) {
+            runs.push_back({(int)row, r, seed + row * replicates + r, vectors[row]});
+        }
+    }
+
+    vector<SimulationResult> results;
+    Py_BEGIN_ALLOW_THREADS
+    results = dispatchConfig(PrecompiledConfigs{}, [&]<typename C>() { return simulateRuns<C>(runs, threads); });
+    Py_END_ALLOW_THREADS
+
+    PyObject* all = PyList_New((Py_ssize_t)vectors.size());
+    if (!all)
+        return nullptr;
+    for (size_t row = 0; row < vectors.size(); row++) {
+        PyObject* row_list = PyList_New(replicates);
+        if (!row_list) {
+            Py_DECREF(all);
+            return nullptr;
+        }
+        PyList_SET_ITEM(all, (Py_ssize_t)row, row_list);
+        for (int r = 0; r < replicates; r++) {
+            size_t i = row * replicates + r;
+            PyObject* run = Py_BuildValue("{s:i,s:K,s:n,s:n}",
+                                          "replicate", r,
+                                          "seed", (unsigned long long)runs[i].seed,
+                                          "fish_eaten", (Py_ssize_t)results[i].fish_eaten,
+                                          "food_eaten", (Py_ssize_t)results[i].food_eaten);
+            if (!run) {
+                Py_DECREF(all);
+                return nullptr;
+            }
+            PyList_SET_ITEM(row_list, r, run);
+        }
+    }
+    return all;
+}
+
+static PyObject* simulate(PyObject*, PyObject* args, PyObject* kwargs) {
+    static const char* keywords[] = {"params", "seed", "replicates", "threads", nullptr};
+    PyObject* params_obj;
+    PyObject* seed_obj = Py_None;
+    int replicates = 1;
+    int threads = 0;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|Oii", (char**)keywords,
+                                     &params_obj, &seed_obj, &replicates, &threads))
+        return nullptr;
+
+    vector<ModelParams> vectors(1);
+    if (!parseParams(params_obj, vectors[0]))
+        return nullptr;
+
+    PyObject* all = simulateVectors(vectors, seed_obj, replicates, threads);
+    if (!all)
+        return nullptr;
+    PyObject* runs = PyList_GET_ITEM(all, 0);
+    Py_INCREF(runs);
+    Py_DECREF(all);
+    return runs;
+}
+
+static PyObject* simulatePopulation(PyObject*, PyObject* args, PyObject* kwargs) {
+    static const char* keywords[] = {"population", "seed", "replicates", "threads", nullptr};
+    PyObject* population_obj;
+    PyObject* seed_obj = Py_None;
+    int replicates = 1;
+    int threads = 0;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|Oii", (char**)keywords,
+                                     &population_obj, &seed_obj, &replicates, &threads))
+        return nullptr;
+
+    PyObject* population = PySequence_Fast(population_obj, "population must be a sequence");
+    if (!population)
+        return nullptr;
+    vector<ModelParams> vectors(PySequence_Fast_GET_SIZE(population));
+    for (size_t i = 0; i < vectors.size(); i++) {
+        if (!parseParams(PySequence_Fast_GET_ITEM(population, i), vectors[i])) {
+            Py_DECREF(population);
+            return nullptr;
+        }
+    }
+    Py_DECREF(population);
+
+    return simulateVectors(vectors, seed_obj, replicates, threads);
+}
+
+// read-only 1-D buffer over engine storage, keeps its owner (the Simulation) alive while it is viewed
+struct ArrayViewObject {
+    PyObject_HEAD
+    PyObject* owner;
+    const void* data;
+    Py_ssize_t shape[1];
+    Py_ssize_t strides[1];
+    const char* format;
+};
+
+static int arrayViewGetBuffer(PyObject* self, Py_buffer* view, int flags) {
+    auto* array = (ArrayViewObject*)self;
+    if (flags & PyBUF_WRITABLE) {
+        PyErr_SetString(PyExc_BufferError, "simulation state is read-only");
+        return -1;
+    }
+    view->buf = (void*)array->data;
+    view->obj = self;
+    Py_INCREF(self);
+    view->len = array->shape[0] * array->strides[0];
+    view->readonly = 1;
+    view->itemsize = array->strides[0];
+    view->format = (flags & PyBUF_FORMAT) ? (char*)array->format : nullptr;
+    view->ndim = 1;
+    view->shape = (flags & PyBUF_ND) ? array->shape : nullptr;
+    view->strides = (flags & PyBUF_STRIDES) ? array->strides : nullptr;
+    view->suboffsets = nullptr;
+    view->internal = nullptr;
+    return 0;
+}
+
+static void arrayViewDealloc(PyObject* self) {
+    PyTypeObject* type = Py_TYPE(self);
+    Py_XDECREF(((ArrayViewObject*)self)->owner);
+    type->tp_free(self);
+    Py_DECREF(type);
+}
+
+static PyType_Slot arrayViewSlots[] = {
+        {Py_tp_doc, (void*)"Read-only buffer over the simulation state."},
+        {Py_tp_dealloc, (void*)arrayViewDealloc},
+        {Py_bf_getbuffer, (void*)arrayViewGetBuffer},
+        {0, nullptr},
+};
+
+static PyType_Spec arrayViewSpec = {"fish_simulation.ArrayView", sizeof(ArrayViewObject), 0, Py_TPFLAGS_DEFAULT,
+                                    arrayViewSlots};
+
+static PyTypeObject* ArrayViewType = nullptr;
+
+// memoryview of `length` items of the given struct format (e.g. "f") starting at `data`, owned by `owner`
+template<typename T>
+static PyObject* viewArray(PyObject* owner, const T* data, size_t length, const char* format) {
+    auto* array = PyObject_New(ArrayViewObject, ArrayViewType);
+    if (!array)
+        return nullptr;
+    Py_INCREF(owner);
+    array->owner = owner;
+    array->data = data;
+    array->shape[0] = (Py_ssize_t)length;
+    array->strides[0] = sizeof(T);
+    array->format = format;
+    PyObject* view = PyMemoryView_FromObject((PyObject*)array);
+    Py_DECREF(array);
+    return view;
+}
+
+// scene of any configuration, behind one interface
+struct SceneHandle {
+    virtual ~SceneHandle() = default;
+    virtual SimulationResult advance() = 0;
+    virtual const EntityStore& swarm() const = 0;
+    virtual const EntityStore& sharks() const = 0;
+    virtual const EntityStore& food() const = 0;
+};
+
+template<typename C>
+struct SceneHandleImpl : SceneHandle {
+    Scene<C> scene;
+
+    SceneHandleImpl(const ModelParams& params, uint64_t seed) : scene(params, seed) {}
+
+    SimulationResult advance() override {
+        auto counts = scene.advance();
+        return {counts.fish_eaten, counts.food_eaten};
+    }
+    const EntityStore& swarm() const override { return scene.getSwarm(); }
+    const EntityStore& sharks() const override { return scene.getSharks(); }
+    const EntityStore& food() const override { return scene.getFood(); }
+};
+
+// a scene stepped from Python, its state is exposed without copies (see `simulationGetters`)
+struct SimulationState {
+    std::unique_ptr<SceneHandle> scene;
+    int steps = 0;          // length of the simulation, the per-step counters are allocated for all steps up front
+    int current_step = 0;
+    bool running = false;   // a run (without the GIL) is in progress
+    vector<int64_t> fish_eaten, food_eaten;
+};
+
+struct SimulationObject {
+    PyObject_HEAD
+    SimulationState* state;
+};
+
+static int simulationInit(PyObject* self, PyObject* args, PyObject* kwargs) {
+    static const char* keywords[] = {"params", "seed", "steps", nullptr};
+    PyObject* params_obj = nullptr;
+    PyObject* seed_obj = Py_None;
+    int steps = NUM_STEPS;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|OOi", (char**)keywords, &params_obj, &seed_obj, &steps))
+        return -1;
+
+    ModelParams params = ModelParams::fromGlobals();
+    if (params_obj && !parseParams(params_obj, params))
+        return -1;
+    uint64_t seed;
+    if (!parseSeed(seed_obj, seed))
+        return -1;
+    if (steps < 0) {
+        PyErr_SetString(PyExc_ValueError, "steps must not be negative");
+        return -1;
+    }
+
+    // the memoryviews of the state point into the scene, so it can never be replaced while the object lives
+    auto* simulation = (SimulationObject*)self;
+    if (simulation->state) {
+        PyErr_SetString(PyExc_RuntimeError, "the simulation is already initialized, create a new one instead");
+        return -1;
+    }
+    auto* state = new SimulationState();
+    state->scene = dispatchConfig(PrecompiledConfigs{}, [&]<typename C>() -> std::unique_ptr<SceneHandle> {
+        return std::make_unique<SceneHandleImpl<C>>(params, seed);
+    });
+    state->steps = steps;
+    state->fish_eaten.assign(steps, 0);
+    state->food_eaten.assign(steps, 0);
+    simulation->state = state;
+    return 0;
+}
+
+static void simulationDealloc(PyObject* self) {
+    PyTypeObject* type = Py_TYPE(self);
+    delete ((SimulationObject*)self)->state;
+    type->tp_free(self);
+    Py_DECREF(type);
+}
+
+static SimulationState* simulationState(PyObject* self) {
+    SimulationState* state = ((SimulationObject*)self)->state;
+    if (!state)
+        PyErr_SetString(PyExc_RuntimeError, "the simulation is not initialized");
+    return state;
+}
+
+// run(steps=None, trajectory=None) - advance by `steps` (all the remaining ones by default) without the GIL
+// `trajectory` is an optional writable C-contiguous float32 buffer of shape [steps, fish, 2], which gets
+// the fish positions after every step
+static PyObject* simulationRun(PyObject* self, PyObject* args, PyObject* kwargs) {
+    static const char* keywords[] = {"steps", "trajectory", nullptr};
+    SimulationState* state = simulationState(self);
+    if (!state)
+        return nullptr;
+    int steps = state->steps - state->current_step;
+    PyObject* trajectory_obj = Py_None;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|iO", (char**)keywords, &steps, &trajectory_obj))
+        return nullptr;
+    if (steps < 0 || steps > state->steps - state->current_step) {
+        PyErr_Format(PyExc_ValueError, "only %d steps remain", state->steps - state->current_step);
+        return nullptr;
+    }
+    if (state->running) {
+        PyErr_SetString(PyExc_RuntimeError, "the simulation is already running");
+        return nullptr;
+    }
+
+    Py_buffer trajectory{};
+    bool record = trajectory_obj != Py_None;
+    size_t num_fish = state->scene->swarm().size();
+    if (record) {
+        if (PyObject_GetBuffer(trajectory_obj, &trajectory, PyBUF_C_CONTIGUOUS | PyBUF_WRITABLE | PyBUF_FORMAT) < 0)
+            return nullptr;
+        bool is_float = trajectory.itemsize == sizeof(float) &&
+                        (std::strcmp(trajectory.format, "f") == 0 || std::strcmp(trajectory.format, "<f") == 0 ||
+                         std::strcmp(trajectory.format, "=f") == 0);
+        if (!is_float || trajectory.len != (Py_ssize_t)(steps * num_fish * 2 * sizeof(float))) {
+            PyBuffer_Release(&trajectory);
+            PyErr_Format(PyExc_ValueError, "trajectory must be a float32 array of shape [%d, %zu, 2]", steps, num_fish);
+            return nullptr;
+        }
+    }
+
+    state->running = true;
+    Py_BEGIN_ALLOW_THREADS
+    auto* positions = (float*)trajectory.buf;
+    for (int k = 0; k < steps; k++) {
+        SimulationResult counts = state->scene->advance();
+        state->fish_eaten[state->current_step] = (int64_t)counts.fish_eaten;
+        state->food_eaten[state->current_step] = (int64_t)counts.food_eaten;
+        state->current_step++;
+        if (record) {
+            const EntityStore& swarm = state->scene->swarm();
+            float* frame = positions + (size_t)k * num_fish * 2;
+            for (size_t i = 0; i < num_fish; i++) {
+                frame[2 * i] = swarm.pos_x[i];
+                frame[2 * i + 1] = swarm.pos_y[i];
+            }
+        }
+    }
+    Py_END_ALLOW_THREADS
+    state->running = false;
+
+    if (record)
+        PyBuffer_Release(&trajectory);
+    Py_RETURN_NONE;
+}
+
+// views of one field of the state, `closure` selects it
+enum class StateField {
+    FishX, FishY, FishDirX, FishDirY, FishAlive,
+    SharkX, SharkY, SharkDirX, SharkDirY,
+    FoodX, FoodY, FoodAlive,
+    FishEaten, FoodEaten,
+};
+
+static PyObject* simulationGetField(PyObject* self, void* closure) {
+    SimulationState* state = simulationState(self);
+    if (!state)
+        return nullptr;
+    const EntityStore& swarm = state->scene->swarm();
+    const EntityStore& sharks = state->scene->sharks();
+    const EntityStore& food = state->scene->food();
+    switch ((StateField)(intptr_t)closure) {
+        case StateField::FishX: return viewArray(self, swarm.pos_x.data(), swarm.size(), "f");
+        case StateField::FishY: return viewArray(self, swarm.pos_y.data(), swarm.size(), "f");
+        case StateField::FishDirX: return viewArray(self, swarm.dir_x.data(), swarm.size(), "f");
+        case StateField::FishDirY: return viewArray(self, swarm.dir_y.data(), swarm.size(), "f");
+        case StateField::FishAlive: return viewArray(self, swarm.alive.data(), swarm.size(), "B");
+        case StateField::SharkX: return viewArray(self, sharks.pos_x.data(), sharks.size(), "f");
+        case StateField::SharkY: return viewArray(self, sharks.pos_y.data(), sharks.size(), "f");
+        case StateField::SharkDirX: return viewArray(self, sharks.dir_x.data(), sharks.size(), "f");
+        case StateField::SharkDirY: return viewArray(self, sharks.dir_y.data(), sharks.size(), "f");
+        case StateField::FoodX: return viewArray(self, food.pos_x.data(), food.size(), "f");
+        case StateField::FoodY: return viewArray(self, food.pos_y.data(), food.size(), "f");
+        case StateField::FoodAlive: return viewArray(self, food.alive.data(), food.size(), "B");
+        case StateField::FishEaten: return viewArray(self, state->fish_eaten.data(), state->current_step, "q");
+        case StateField::FoodEaten: return viewArray(self, state->food_eaten.data(), state->current_step, "q");
+    }
+    Py_RETURN_NONE;
+}
+
+static PyObject* simulationGetStep(PyObject* self, void*) {
+    SimulationState* state = simulationState(self);
+    return state ? PyLong_FromLong(state->current_step) : nullptr;
+}
+
+static PyObject* simulationGetSteps(PyObject* self, void*) {
+    SimulationState* state = simulationState(self);
+    return state ? PyLong_FromLong(state->steps) : nullptr;
+}
+
+#define STATE_FIELD(name, field, doc) {name, simulationGetField, nullptr, doc, (void*)(intptr_t)StateField::field}
+
+// the views follow the state as the simulation runs (they read the engine storage, which never moves)
+static PyGetSetDef simulationGetters[] = {
+        STATE_FIELD("fish_x", FishX, "x positions of fish (float32, by fish id)"),
+        STATE_FIELD("fish_y", FishY, "y positions of fish (float32, by fish id)"),
+        STATE_FIELD("fish_dir_x", FishDirX, "x directions of fish (float32, by fish id)"),
+        STATE_FIELD("fish_dir_y", FishDirY, "y directions of fish (float32, by fish id)"),
+        STATE_FIELD("fish_alive", FishAlive, "alive mask of fish (uint8, by fish id)"),
+        STATE_FIELD("shark_x", SharkX, "x positions of sharks (float32)"),
+        STATE_FIELD("shark_y", SharkY, "y positions of sharks (float32)"),
+        STATE_FIELD("shark_dir_x", SharkDirX, "x directions of sharks (float32)"),
+        STATE_FIELD("shark_dir_y", SharkDirY, "y directions of sharks (float32)"),
+        STATE_FIELD("food_x", FoodX, "x positions of food (float32, by slot)"),
+        STATE_FIELD("food_y", FoodY, "y positions of food (float32, by slot)"),
+        STATE_FIELD("food_alive", FoodAlive, "mask of food that was not eaten (uint8, by slot)"),
+        STATE_FIELD("fish_eaten", FishEaten, "fish eaten in every simulated step (int64)"),
+        STATE_FIELD("food_eaten", FoodEaten, "food eaten in every simulated step (int64)"),
+        {"step", simulationGetStep, nullptr, "number of simulated steps", nullptr},
+        {"steps", simulationGetSteps, nullptr, "length of the simulation", nullptr},
+        {nullptr, nullptr, nullptr, nullptr, nullptr},
+};
+
+static PyMethodDef simulationMethods[] = {
+        {"run", (PyCFunction)(void (*)(void))simulationRun, METH_VARARGS | METH_KEYWORDS,
+         "run(steps=None, trajectory=None)\n--\n\n"
+         "Advance by `steps` (all remaining by default), optionally recording fish positions into `trajectory`,\n"
+         "a writable float32 array of shape [steps, fish, 2]."},
+        {nullptr, nullptr, 0, nullptr},
+};
+
+static PyType_Slot simulationSlots[] = {
+        {Py_tp_doc, (void*)"Simulation(params=None, seed=None, steps=NUM_STEPS)\n--\n\n"
+                           "One scene stepped from Python, its state is exposed as zero-copy memoryviews."},
+        {Py_tp_new, (void*)PyType_GenericNew},
+        {Py_tp_init, (void*)simulationInit},
+        {Py_tp_dealloc, (void*)simulationDealloc},
+        {Py_tp_methods, simulationMethods},
+        {Py_tp_getset, simulationGetters},
+        {0, nullptr},
+};
+
+static PyType_Spec simulationSpec = {"fish_simulation.Simulation", sizeof(SimulationObject), 0, Py_TPFLAGS_DEFAULT,
+                                     simulationSlots};
+
+static PyMethodDef methods[] = {
+        {"simulate", (PyCFunction)(void (*)(void))simulate, METH_VARARGS | METH_KEYWORDS,
+         "simulate(params, seed=None, replicates=1, threads=0)\n--\n\n"
+         "Run replicates of the simulation with the given parameters, return the list of their results."},
+        {"simulate_population", (PyCFunction)(void (*)(void))simulatePopulation, METH_VARARGS | METH_KEYWORDS,
+         "simulate_population(population, seed=None, replicates=1, threads=0)\n--\n\n"
+         "Run replicates of the simulation for every parameter vector, return the list of their result lists."},
+        {nullptr, nullptr, 0, nullptr},
+};
+
+static PyModuleDef module = {
+        PyModuleDef_HEAD_INIT, "fish_simulation", "In-process fish swarm simulation.", -1, methods,
+        nullptr, nullptr, nullptr, nullptr,
+};
+
+PyMODINIT_FUNC PyInit_fish_simulation() {
+    neighbourSums = selectNeighbourSumsKernel("auto");
+
+    ArrayViewType = (PyTypeObject*)PyType_FromSpec(&arrayViewSpec);
+    if (!ArrayViewType)
+        return nullptr;
+    PyObject* simulation_type = PyType_FromSpec(&simulationSpec);
+    if (!simulation_type)
+        return nullptr;
+
+    PyObject* m = PyModule_Create(&module);
+    if (!m)
+        return nullptr;
+    if (PyModule_AddObject(m, "Simulation", simulation_type) < 0) {
+        Py_DECREF(simulation_type);
+        Py_DECREF(m);
+        return nullptr;
+    }
+    return m;
+}
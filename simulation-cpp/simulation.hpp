@@ -0,0 +1,3119 @@
+#pragma once
+
+// the simulation engine, shared by the simulator binary (main.cpp) and the Python module (python_module.cpp)
+
+#include <vector>
+#include <iostream>
+#include <cmath>
+#include <ctime>
+#include <random>
+#include <fstream>
+#include <algorithm>
+#include <span>
+#include <cstdint>
+#include <cstring>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <deque>
+#include <charconv>
+#include <optional>
+#include <atomic>
+#include <filesystem>
+#include "glm/glm/glm.hpp"
+#include "glm/glm/gtx/norm.hpp"
+#include "glm/glm/gtx/vector_angle.hpp"
+#include "trajectory.hpp"
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+#if defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+
+using namespace std;
+
+// We have two types of model parameters:
+
+// 1) OPTIMIZABLE MODEL PARAMETERS - these will be used for parameter optimisation
+// their values can be given via CLI arguments
+// basically factors to multiply various forces of FISH
+inline float FISH_MOMENTUM_CONSTANT = 0.75;
+inline float FISH_FEAR_MOMENTUM_CONSTANT = 0.8; // will be automatically changed to correspond to FISH_MOMENTUM_CONSTANT
+inline float ALIGNMENT_CONSTANT = 0.25;
+inline float COHESION_CONSTANT = 0.05;
+inline float SEPARATION_CONSTANT = 20.;
+inline float SHARK_REPULSION_CONSTANT = 8.;
+inline float FOOD_ATTRACTION_CONSTANT = 0.25;
+
+// 2) FIXED MODEL PARAMETERS - similar, but not to be optimized via evolution
+// mostly shark parameters, or scene params
+// their values can be given via CLI arguments or a config file, common combinations of them run on a scene
+// specialized for them at compile time (see `PrecompiledConfigs`), any other combination on `RuntimeConfig`
+inline int WIDTH = 400;                      // scene width
+inline int HEIGHT = 400;                     // scene height
+
+inline int NUM_STEPS = 1000;                 // number of steps to simulate
+inline int NUM_FISH = 400;                   // total number of fish
+inline int NUM_SHARKS = 1;                   // number of sharks
+inline int NUM_FOOD = 50;                    // number of food in simulation
+
+inline int FISH_SENSE_DIST = 25;             // distance for fish to sense neighbors or food
+inline int FISH_NEIGHBOURS = 0;              // if positive, fish only follow this many nearest neighbours within the sense distance
+inline constexpr int MAX_FISH_NEIGHBOURS = 64;  // capacity of the nearest neighbour heap (see `NearestNeighbours`)
+inline int SHARK_SENSE_DIST = 100;           // distance for shark to sense neighbors
+
+inline int FISH_MAX_SPEED = 4;               // maximal speed of fish
+inline int SHARK_MAX_SPEED = 7;              // maximal speed of sharks
+
+inline int SHARK_KILL_RADIUS = 10;           // distance for which shark can kill
+inline float SHARK_MOMENTUM_CONSTANT = 1.;   // constant which manages how much of previous shark direction is preserved
+inline float SHARK_SEARCH_CONSTANT = 2.;     // constant which manages behaviour of shark when no fish is around in his SENSE_DIST
+inline float SHARK_HUNT_CONSTANT = 40.;      // constant which manages behaviour of shark when there are fish around in his SENSE_DIST
+
+inline int FISH_DIM_ELLIPSE_X = 5;           // size of a fish (defined by ellipse) in x-axis
+inline int FISH_DIM_ELLIPSE_Y = 9;           // size of a fish (defined by ellipse) in y-axis
+inline int FISH_FEAR_CONSTANT = 3;           // number of steps when fish continues running from the shark
+
+inline int SHARK_DIM_ELLIPSE_X = 30;         // size of the shark (defined by ellipse) in x-axis
+inline int SHARK_DIM_ELLIPSE_Y = 50;         // size of the shark (defined by ellipse) in y-axis
+
+inline int SHARK_BLIND_ANGLE_DEG = 40;       // the angle (in degrees) of a shark that he cannot see. Middle of the blind spot angle is right behind the shark
+
+inline bool WALL = false;                    // if true, applies the walls around the canvas, else applies scene warping
+
+// 3) SIMULATION ENGINE PARAMETERS - do not change the model, only how it is computed
+inline bool SYNC_UPDATE = false;   // if true, all entities are updated from the previous step's state (double-buffered), in parallel
+inline int NUM_THREADS = 0;        // number of threads for the synchronous update, 0 means all cores
+inline uint64_t SEED = 0;          // seed of all the random numbers, randomly chosen if not given
+inline bool FAST_MATH = false;     // if true, the fish kernel uses approximations with bounded error (see `inverseLength`)
+inline bool FAST_MATH_REPORT = false;
+inline string SIMD = "auto";       // kernel for the neighbourhood sums of the fish update (see `selectNeighbourSumsKernel`)
+inline bool SIMD_REPORT = false;
+inline float VERLET_SKIN = 0;      // if positive, fish neighbours come from Verlet lists with this skin (see `VerletLists`)
+inline int SORT_EVERY = 0;         // if positive, fish slots are re-sorted by the Morton code of their cell every this many steps
+inline string SPATIAL_INDEX = "grid";  // index of fish for the queries: grid, quadtree, or auto (by crowding, see `fishCrowding`)
+inline float QUADTREE_CROWDING = 40;   // auto index: the quadtree is used above this crowding
+inline int MEAN_FIELD = 0;         // if positive, cohesion and alignment come from cells this many times smaller than the sense distance (see `MeanFieldGrid`)
+inline float MEAN_FIELD_CLOSE = 15;  // mean field: separation and collisions use the exact neighbours within this distance
+inline bool MEAN_FIELD_REPORT = false;
+
+// also help/debug/output parameters
+inline bool debug = true; // this enables printing + logging to json
+inline bool help = false;
+inline string LOG_FILEPATH = "output.json";
+inline string LOG_FORMAT = "json";         // "json", or "binary" for the compact trajectory format (see trajectory.hpp)
+inline bool LOG_DELTA = true;              // binary log: delta frames between key frames
+inline int LOG_HEADING_BITS = 16;          // binary log: 16 or 8 bits per heading
+inline int LOG_KEYFRAME_INTERVAL = 100;    // binary log: number of frames from one key frame to the next
+inline int LOG_QUEUE_SIZE = 8;             // steps waiting for the log thread, the simulation blocks only when it is full
+inline int LOG_EVERY = 1;                  // log every k-th step (of the logged window)
+inline int LOG_FROM = 0;                   // first logged step
+inline int LOG_TO = -1;                    // steps from this one on are not logged, -1 logs until the end
+inline vector<int> LOG_FISH;               // ids of the logged fish, all fish if empty
+inline float LOG_NEAR_SHARK = 0;           // if positive, only fish within this distance of a shark are logged
+inline int RECORD_BEFORE = 0;              // flight recorder: if positive, only clips of this many logged steps before
+                                           // a kill and RECORD_AFTER after it are written, instead of the whole log
+inline int RECORD_AFTER = 50;              // flight recorder: logged steps after a kill (another kill extends the clip)
+
+// the step is written to the log (all steps are simulated)
+inline bool isLoggedStep(int step) {
+    return step >= LOG_FROM && (LOG_TO < 0 || step < LOG_TO) && (step - LOG_FROM) % LOG_EVERY == 0;
+}
+
+// only some fish are logged
+inline bool isFishSubsetLogged() {
+    return !LOG_FISH.empty() || LOG_NEAR_SHARK > 0;
+}
+
+// file of the flight recorder clip of a kill, next to the log, e.g. output.kill-123.json for the kill in step 123
+inline string clipFilepath(const string& log_filepath, int kill_step) {
+    std::filesystem::path path(log_filepath);
+    std::filesystem::path clip = path.stem();
+    clip += ".kill-" + std::to_string(kill_step);
+    clip += path.extension();
+    return (path.parent_path() / clip).string();
+}
+
+// optimizable parameters of one scene, so that scenes with different parameters can run at the same time
+struct ModelParams {
+    float fish_momentum;
+    float fish_fear_momentum;
+    float alignment;
+    float cohesion;
+    float separation;
+    float shark_repulsion;
+    float food_attraction;
+
+    // parameters given by the CLI arguments
+    static ModelParams fromGlobals() {
+        return {FISH_MOMENTUM_CONSTANT, FISH_FEAR_MOMENTUM_CONSTANT, ALIGNMENT_CONSTANT, COHESION_CONSTANT,
+                SEPARATION_CONSTANT, SHARK_REPULSION_CONSTANT, FOOD_ATTRACTION_CONSTANT};
+    }
+};
+
+// what the random numbers are used for, each purpose gets its own independent streams
+enum class RandomPurpose : uint32_t {
+    FishSpawn,
+    SharkSpawn,
+    FoodSpawn,
+    FoodDrift,
+    FishNoise,
+    SharkSearch,
+};
+
+// counter-based random numbers ("Squares" generator by B. Widynski)
+// the n-th number of a stream is a pure function of (seed, step, entity id, purpose, n), there is no shared state,
+// so streams are cheap to create anywhere (any thread, any update order) and runs are reproducible for a given seed
+class RandomStream {
+public:
+    RandomStream(uint64_t seed, uint32_t step, uint32_t entity, RandomPurpose purpose) {
+        key = splitmix64(seed ^ splitmix64((uint64_t)purpose + 1)) | 1; // keys must be odd
+        counter = ((uint64_t)step << 36) ^ ((uint64_t)entity << 4);     // up to 16 numbers per stream and step
+    }
+
+    uint32_t next() {
+        uint64_t x, y, z;
+        x = y = counter++ * key;
+        z = y + key;
+        x = x * x + y; x = (x >> 32) | (x << 32);
+        x = x * x + z; x = (x >> 32) | (x << 32);
+        x = x * x + y; x = (x >> 32) | (x << 32);
+        return (uint32_t)((x * x + z) >> 32);
+    }
+
+    // uniformly distributed float in [lo, hi)
+    float uniform(float lo, float hi) {
+        return lo + (hi - lo) * (float)(next() >> 8) * (1.0f / (1 << 24));
+    }
+
+private:
+    uint64_t key;
+    uint64_t counter;
+
+    static uint64_t splitmix64(uint64_t x) {
+        x += 0x9e3779b97f4a7c15ULL;
+        x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+        return x ^ (x >> 31);
+    }
+};
+
+// fixed parameters of a scene known at compile time, the whole engine is specialized for them
+// (numbers of entities and steps are only loop bounds, so they are always taken at runtime)
+template<int width_, int height_, int fish_sense_dist_, int shark_sense_dist_, int shark_kill_radius_,
+         int fish_max_speed_, int shark_max_speed_, int fish_fear_steps_,
+         int fish_dim_ellipse_x_, int fish_dim_ellipse_y_, int shark_dim_ellipse_x_, int shark_dim_ellipse_y_,
+         int shark_blind_angle_deg_, bool wall_>
+struct StaticConfig {
+    static constexpr int width = width_;
+    static constexpr int height = height_;
+    static constexpr int fish_sense_dist = fish_sense_dist_;
+    static constexpr int shark_sense_dist = shark_sense_dist_;
+    static constexpr int shark_kill_radius = shark_kill_radius_;
+    static constexpr int fish_max_speed = fish_max_speed_;
+    static constexpr int shark_max_speed = shark_max_speed_;
+    static constexpr int fish_fear_steps = fish_fear_steps_;
+    static constexpr int fish_dim_ellipse_x = fish_dim_ellipse_x_;
+    static constexpr int fish_dim_ellipse_y = fish_dim_ellipse_y_;
+    static constexpr int shark_dim_ellipse_x = shark_dim_ellipse_x_;
+    static constexpr int shark_dim_ellipse_y = shark_dim_ellipse_y_;
+    static constexpr int shark_blind_angle_deg = shark_blind_angle_deg_;
+    static constexpr bool wall = wall_;
+
+    // true if the parameters given at runtime are exactly these
+    static bool matchesRuntime() {
+        return width == WIDTH && height == HEIGHT &&
+               fish_sense_dist == FISH_SENSE_DIST && shark_sense_dist == SHARK_SENSE_DIST &&
+               shark_kill_radius == SHARK_KILL_RADIUS &&
+               fish_max_speed == FISH_MAX_SPEED && shark_max_speed == SHARK_MAX_SPEED &&
+               fish_fear_steps == FISH_FEAR_CONSTANT &&
+               fish_dim_ellipse_x == FISH_DIM_ELLIPSE_X && fish_dim_ellipse_y == FISH_DIM_ELLIPSE_Y &&
+               shark_dim_ellipse_x == SHARK_DIM_ELLIPSE_X && shark_dim_ellipse_y == SHARK_DIM_ELLIPSE_Y &&
+               shark_blind_angle_deg == SHARK_BLIND_ANGLE_DEG && wall == WALL;
+    }
+};
+
+// fixed parameters of a scene as given at runtime - works for any combination, but nothing is specialized
+struct RuntimeConfig {
+    static inline const int& width = WIDTH;
+    static inline const int& height = HEIGHT;
+    static inline const int& fish_sense_dist = FISH_SENSE_DIST;
+    static inline const int& shark_sense_dist = SHARK_SENSE_DIST;
+    static inline const int& shark_kill_radius = SHARK_KILL_RADIUS;
+    static inline const int& fish_max_speed = FISH_MAX_SPEED;
+    static inline const int& shark_max_speed = SHARK_MAX_SPEED;
+    static inline const int& fish_fear_steps = FISH_FEAR_CONSTANT;
+    static inline const int& fish_dim_ellipse_x = FISH_DIM_ELLIPSE_X;
+    static inline const int& fish_dim_ellipse_y = FISH_DIM_ELLIPSE_Y;
+    static inline const int& shark_dim_ellipse_x = SHARK_DIM_ELLIPSE_X;
+    static inline const int& shark_dim_ellipse_y = SHARK_DIM_ELLIPSE_Y;
+    static inline const int& shark_blind_angle_deg = SHARK_BLIND_ANGLE_DEG;
+    static inline const bool& wall = WALL;
+};
+
+// configurations with their own specialized scene: the defaults, shark speeds of the `results/shark_max_speed`
+// experiments, and the defaults with walls
+using DefaultConfig = StaticConfig<400, 400, 25, 100, 10, 4, 7, 3, 5, 9, 30, 50, 40, false>;
+template<typename... Configs>
+struct ConfigList {};
+using PrecompiledConfigs = ConfigList<
+        DefaultConfig,
+        StaticConfig<400, 400, 25, 100, 10, 4, 5, 3, 5, 9, 30, 50, 40, false>,
+        StaticConfig<400, 400, 25, 100, 10, 4, 9, 3, 5, 9, 30, 50, 40, false>,
+        StaticConfig<400, 400, 25, 100, 10, 4, 7, 3, 5, 9, 30, 50, 40, true>>;
+
+// calls `f.template operator()<Config>()` with the first precompiled configuration matching the runtime
+// parameters, or with `RuntimeConfig` if there is none, and returns its result
+template<typename... Configs, typename F>
+auto dispatchConfig(ConfigList<Configs...>, F f) {
+    using Result = decltype(f.template operator()<RuntimeConfig>());
+    Result result{};
+    bool found = ((Configs::matchesRuntime() && (result = f.template operator()<Configs>(), true)) || ...);
+    if (!found)
+        result = f.template operator()<RuntimeConfig>();
+    return result;
+}
+
+template<typename C>
+inline glm::vec2 getRandomPlace(RandomStream& rng) {
+    float x = (float)(rng.next() % C::width);
+    float y = (float)(rng.next() % C::height);
+    return {x, y};
+}
+
+// components in (-1, 1), the sign is computed signed (`next()` is unsigned, 1 - 2 would wrap around)
+inline glm::vec2 getRandomDirection(RandomStream& rng) {
+    float x = (float)(1 - 2 * (int)(rng.next() % 2)) * (float) (rng.next() % 1000000) / 1000000;
+    float y = (float)(1 - 2 * (int)(rng.next() % 2)) * (float) (rng.next() % 1000000) / 1000000;
+    return {x, y};
+}
+
+template<typename C>
+inline glm::vec2 getNearestBorderPoint(glm::vec2 fishPosition) {
+    glm::vec2 nearestPoint;
+
+    // Find the closest border to the fish
+    float leftDist = fishPosition.x;
+    float rightDist = C::width - fishPosition.x;
+    float topDist = fishPosition.y;
+    float bottomDist = C::height - fishPosition.y;
+
+    float minDist = std::min({leftDist, rightDist, topDist, bottomDist});
+
+    // Calculate the nearest point on the border
+    if (minDist == leftDist) {
+        nearestPoint = glm::vec2(0.0f, fishPosition.y);
+    } else if (minDist == rightDist) {
+        nearestPoint = glm::vec2(C::width, fishPosition.y);
+    } else if (minDist == topDist) {
+        nearestPoint = glm::vec2(fishPosition.x, 0.0f);
+    } else if (minDist == bottomDist) {
+        nearestPoint = glm::vec2(fishPosition.x, C::height);
+    }
+
+    return nearestPoint;
+}
+
+template<typename C>
+bool isFishOutOfBorders(glm::vec2 fishPosition) {
+    return (fishPosition.x < 0 || fishPosition.x > C::width || fishPosition.y < 0 || fishPosition.y > C::height);
+}
+
+// overlap distances of ellipse 1 against a batch of ellipses 2 (positive value means overlap)
+// the ellipses are given by their orientation frames (unit heading vectors, computed once per step), so the
+// rotation matrices need no trigonometry: rotation by the heading (c, s) is the matrix ((c, s), (-s, c))
+// ellipse 2 is given by the offset of its center from center 1 (`dx`, `dy`) and its heading (`hx`, `hy`)
+// for every ellipse 2, the overlap is computed both for `frame1` (`overlap_pos`) and for the opposite frame
+// (`overlap_neg`), as a colliding fish reverses its direction; zero heading of ellipse 2 means no overlap
+// the loop has no branches and works on plain arrays, so the compiler can vectorize it
+// (it is inlined into the callers, so sizes known at compile time are folded in)
+inline void ellipsesOverlapBatch(glm::vec2 size1, glm::vec2 size2, glm::vec2 frame1, int n,
+                                 const float* dx, const float* dy, const float* hx, const float* hy,
+                                 float* overlap_pos, float* overlap_neg) {
+    const float r1x = size1.x / 2.0f, r1y = size1.y / 2.0f;
+    const float r2x = size2.x / 2.0f, r2y = size2.y / 2.0f;
+    const float c1 = frame1.x, s1 = frame1.y;
+
+    for (int k = 0; k < n; k++) {
+        // center 2 in the coordinate system of ellipse 1, and the distance of the centers
+        float tx = c1 * dx[k] - s1 * dy[k];
+        float ty = s1 * dx[k] + c1 * dy[k];
+        float distance = std::sqrt(tx * tx + ty * ty);
+
+        // radii of ellipse 2 rotated by both rotations (the composed rotation is by the sum of the angles)
+        float c = c1 * hx[k] - s1 * hy[k];
+        float s = s1 * hx[k] + c1 * hy[k];
+        float rx = c * r2x - s * r2y;
+        float ry = s * r2x + c * r2y;
+
+        // projections of the radii onto the center vector, flipping the frame 1 negates both the center
+        // and the rotated radii of ellipse 2, so only the sign of the radii 1 projection changes
+        float proj1 = (r1x * tx + r1y * ty) / distance;
+        float proj2 = (rx * tx + ry * ty) / distance;
+        bool valid = hx[k] != 0 || hy[k] != 0;
+        overlap_pos[k] = valid ? proj1 + proj2 - distance : -1.0f;
+        overlap_neg[k] = valid ? proj2 - proj1 - distance : -1.0f;
+    }
+}
+
+// approximation of 1/sqrt(x) - bit trick for the initial guess, refined by one Newton step
+// the relative error is below 1.8e-3 for all normal positive floats
+inline float fastInverseSqrt(float x) {
+    uint32_t bits;
+    std::memcpy(&bits, &x, sizeof(bits));
+    bits = 0x5f375a86 - (bits >> 1);
+    float y;
+    std::memcpy(&y, &bits, sizeof(y));
+    return y * (1.5f - 0.5f * x * y * y);
+}
+
+// 1 / |v| - exact, or approximated when FAST_MATH is enabled
+inline float inverseLength(glm::vec2 v) {
+    float length2 = glm::dot(v, v);
+    if (FAST_MATH)
+        return fastInverseSqrt(length2);
+    return 1.0f / std::sqrt(length2);
+}
+
+// number of threads that may run the parallel loops, and index of the calling thread
+inline int maxThreads() {
+#ifdef _OPENMP
+    return omp_get_max_threads();
+#else
+    return 1;
+#endif
+}
+
+inline int threadIndex() {
+#ifdef _OPENMP
+    return omp_get_thread_num();
+#else
+    return 0;
+#endif
+}
+
+// calculates position of mout hof the shark given the center
+template<typename C>
+glm::vec2 getMouthFromCenter (glm::vec2 pos, glm::vec2 dir) {
+    return pos + (((float)C::shark_dim_ellipse_y/2) / glm::length(dir)) * dir;
+}
+
+
+// shortest displacement vector from `from` to `to`
+// without walls the scene wraps around (torus), so the nearest periodic image of `to` is used (minimum image)
+template<typename C>
+inline glm::vec2 sceneOffset(glm::vec2 from, glm::vec2 to) {
+    glm::vec2 d = to - from;
+    if (!C::wall) {
+        if (d.x > C::width / 2.f) d.x -= C::width;
+        else if (d.x < -C::width / 2.f) d.x += C::width;
+        if (d.y > C::height / 2.f) d.y -= C::height;
+        else if (d.y < -C::height / 2.f) d.y += C::height;
+    }
+    return d;
+}
+
+// sums over the neighbourhood of one fish, needed by cohesion, separation and alignment
+struct NeighbourSums {
+    glm::vec2 offset{0};    // sum of offsets of neighbours from the fish (to their nearest periodic images)
+    glm::vec2 away{0};      // sum of (pos - n_pos) / |pos - n_pos|^2 over the neighbours other than the fish itself
+    glm::vec2 heading{0};   // sum of unit headings, zero heading counts as (1, 0) (heading angle 0, like atan2(0, 0))
+};
+
+// neighbourhood of one fish given as slots into the per-field arrays of the swarm
+// `half_width`/`half_height` are used for the minimum image, they are infinite if the scene does not wrap
+struct NeighbourSumsInput {
+    glm::vec2 pos;
+    int self;
+    const int* neighbours;
+    int count;
+    const float* pos_x;
+    const float* pos_y;
+    const float* head_x;
+    const float* head_y;
+    float width, height;
+    float half_width, half_height;
+};
+
+using NeighbourSumsKernel = NeighbourSums (*)(const NeighbourSumsInput&);
+
+// contribution of a single neighbour, also used for the remainders of the vectorized kernels
+inline void addNeighbour(const NeighbourSumsInput& in, int n, NeighbourSums& sums) {
+    glm::vec2 d(in.pos_x[n] - in.pos.x, in.pos_y[n] - in.pos.y);
+    if (d.x > in.half_width) d.x -= in.width;
+    else if (d.x < -in.half_width) d.x += in.width;
+    if (d.y > in.half_height) d.y -= in.height;
+    else if (d.y < -in.half_height) d.y += in.height;
+    sums.offset += d;
+
+    if (n != in.self) {
+        sums.away -= d / glm::length2(d);
+    }
+
+    if (in.head_x[n] != 0 || in.head_y[n] != 0) {
+        sums.heading += glm::vec2(in.head_x[n], in.head_y[n]);
+    } else {
+        sums.heading.x += 1;
+    }
+}
+
+// reference implementation
+inline NeighbourSums neighbourSumsScalar(const NeighbourSumsInput& in) {
+    NeighbourSums sums;
+    for (int k = 0; k < in.count; k++) {
+        addNeighbour(in, in.neighbours[k], sums);
+    }
+    return sums;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+// horizontal sums of the lanes (lambdas would not inherit the target of the kernel)
+__attribute__((target("avx2")))
+inline float sum(__m256 v) {
+    alignas(32) float lanes[8];
+    _mm256_store_ps(lanes, v);
+    return ((lanes[0] + lanes[1]) + (lanes[2] + lanes[3])) + ((lanes[4] + lanes[5]) + (lanes[6] + lanes[7]));
+}
+
+__attribute__((target("sse4.2")))
+inline float sum(__m128 v) {
+    alignas(16) float lanes[4];
+    _mm_store_ps(lanes, v);
+    return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+}
+
+// 8 neighbours at once, positions and headings are gathered by their slots
+__attribute__((target("avx2")))
+inline NeighbourSums neighbourSumsAvx2(const NeighbourSumsInput& in) {
+    const __m256 px = _mm256_set1_ps(in.pos.x), py = _mm256_set1_ps(in.pos.y);
+    const __m256 w = _mm256_set1_ps(in.width), h = _mm256_set1_ps(in.height);
+    const __m256 hw = _mm256_set1_ps(in.half_width), hh = _mm256_set1_ps(in.half_height);
+    const __m256 neg_hw = _mm256_set1_ps(-in.half_width), neg_hh = _mm256_set1_ps(-in.half_height);
+    const __m256 zero = _mm256_setzero_ps(), one = _mm256_set1_ps(1.0f);
+    const __m256i self = _mm256_set1_epi32(in.self);
+    __m256 off_x = zero, off_y = zero, away_x = zero, away_y = zero, head_x = zero, head_y = zero;
+
+    int k = 0;
+    for (; k + 8 <= in.count; k += 8) {
+        __m256i idx = _mm256_loadu_si256((const __m256i*)(in.neighbours + k));
+        __m256 dx = _mm256_sub_ps(_mm256_i32gather_ps(in.pos_x, idx, 4), px);
+        __m256 dy = _mm256_sub_ps(_mm256_i32gather_ps(in.pos_y, idx, 4), py);
+        dx = _mm256_sub_ps(dx, _mm256_and_ps(_mm256_cmp_ps(dx, hw, _CMP_GT_OQ), w));
+        dx = _mm256_add_ps(dx, _mm256_and_ps(_mm256_cmp_ps(dx, neg_hw, _CMP_LT_OQ), w));
+        dy = _mm256_sub_ps(dy, _mm256_and_ps(_mm256_cmp_ps(dy, hh, _CMP_GT_OQ), h));
+        dy = _mm256_add_ps(dy, _mm256_and_ps(_mm256_cmp_ps(dy, neg_hh, _CMP_LT_OQ), h));
+        off_x = _mm256_add_ps(off_x, dx);
+        off_y = _mm256_add_ps(off_y, dy);
+
+        __m256 not_self = _mm256_castsi256_ps(_mm256_xor_si256(_mm256_cmpeq_epi32(idx, self), _mm256_set1_epi32(-1)));
+        __m256 inv_d2 = _mm256_div_ps(one, _mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)));
+        away_x = _mm256_sub_ps(away_x, _mm256_and_ps(not_self, _mm256_mul_ps(dx, inv_d2)));
+        away_y = _mm256_sub_ps(away_y, _mm256_and_ps(not_self, _mm256_mul_ps(dy, inv_d2)));
+
+        __m256 hx = _mm256_i32gather_ps(in.head_x, idx, 4);
+        __m256 hy = _mm256_i32gather_ps(in.head_y, idx, 4);
+        __m256 no_heading = _mm256_and_ps(_mm256_cmp_ps(hx, zero, _CMP_EQ_OQ), _mm256_cmp_ps(hy, zero, _CMP_EQ_OQ));
+        head_x = _mm256_add_ps(head_x, _mm256_blendv_ps(hx, one, no_heading));
+        head_y = _mm256_add_ps(head_y, hy);
+    }
+
+    NeighbourSums sums;
+    sums.offset = {sum(off_x), sum(off_y)};
+    sums.away = {sum(away_x), sum(away_y)};
+    sums.heading = {sum(head_x), sum(head_y)};
+    for (; k < in.count; k++) {
+        addNeighbour(in, in.neighbours[k], sums);
+    }
+    return sums;
+}
+
+// 4 neighbours at once, SSE has no gather, so the lanes are loaded one by one
+__attribute__((target("sse4.2")))
+inline NeighbourSums neighbourSumsSse42(const NeighbourSumsInput& in) {
+    const __m128 px = _mm_set1_ps(in.pos.x), py = _mm_set1_ps(in.pos.y);
+    const __m128 w = _mm_set1_ps(in.width), h = _mm_set1_ps(in.height);
+    const __m128 hw = _mm_set1_ps(in.half_width), hh = _mm_set1_ps(in.half_height);
+    const __m128 neg_hw = _mm_set1_ps(-in.half_width), neg_hh = _mm_set1_ps(-in.half_height);
+    const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f);
+    const __m128i self = _mm_set1_epi32(in.self);
+    __m128 off_x = zero, off_y = zero, away_x = zero, away_y = zero, head_x = zero, head_y = zero;
+
+    int k = 0;
+    for (; k + 4 <= in.count; k += 4) {
+        const int* n = in.neighbours + k;
+        __m128i idx = _mm_loadu_si128((const __m128i*)n);
+        __m128 dx = _mm_sub_ps(_mm_setr_ps(in.pos_x[n[0]], in.pos_x[n[1]], in.pos_x[n[2]], in.pos_x[n[3]]), px);
+        __m128 dy = _mm_sub_ps(_mm_setr_ps(in.pos_y[n[0]], in.pos_y[n[1]], in.pos_y[n[2]], in.pos_y[n[3]]), py);
+        dx = _mm_sub_ps(dx, _mm_and_ps(_mm_cmpgt_ps(dx, hw), w));
+        dx = _mm_add_ps(dx, _mm_and_ps(_mm_cmplt_ps(dx, neg_hw), w));
+        dy = _mm_sub_ps(dy, _mm_and_ps(_mm_cmpgt_ps(dy, hh), h));
+        dy = _mm_add_ps(dy, _mm_and_ps(_mm_cmplt_ps(dy, neg_hh), h));
+        off_x = _mm_add_ps(off_x, dx);
+        off_y = _mm_add_ps(off_y, dy);
+
+        __m128 is_self = _mm_castsi128_ps(_mm_cmpeq_epi32(idx, self));
+        __m128 inv_d2 = _mm_div_ps(one, _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)));
+        away_x = _mm_sub_ps(away_x, _mm_andnot_ps(is_self, _mm_mul_ps(dx, inv_d2)));
+        away_y = _mm_sub_ps(away_y, _mm_andnot_ps(is_self, _mm_mul_ps(dy, inv_d2)));
+
+        __m128 hx = _mm_setr_ps(in.head_x[n[0]], in.head_x[n[1]], in.head_x[n[2]], in.head_x[n[3]]);
+        __m128 hy = _mm_setr_ps(in.head_y[n[0]], in.head_y[n[1]], in.head_y[n[2]], in.head_y[n[3]]);
+        __m128 no_heading = _mm_and_ps(_mm_cmpeq_ps(hx, zero), _mm_cmpeq_ps(hy, zero));
+        head_x = _mm_add_ps(head_x, _mm_blendv_ps(hx, one, no_heading));
+        head_y = _mm_add_ps(head_y, hy);
+    }
+
+    NeighbourSums sums;
+    sums.offset = {sum(off_x), sum(off_y)};
+    sums.away = {sum(away_x), sum(away_y)};
+    sums.heading = {sum(head_x), sum(head_y)};
+    for (; k < in.count; k++) {
+        addNeighbour(in, in.neighbours[k], sums);
+    }
+    return sums;
+}
+#endif
+
+#if defined(__aarch64__)
+// 4 neighbours at once, NEON is always available on 64-bit ARM (no gather, lanes are loaded one by one)
+inline NeighbourSums neighbourSumsNeon(const NeighbourSumsInput& in) {
+    const float32x4_t px = vdupq_n_f32(in.pos.x), py = vdupq_n_f32(in.pos.y);
+    const float32x4_t w = vdupq_n_f32(in.width), h = vdupq_n_f32(in.height);
+    const float32x4_t hw = vdupq_n_f32(in.half_width), hh = vdupq_n_f32(in.half_height);
+    const float32x4_t neg_hw = vdupq_n_f32(-in.half_width), neg_hh = vdupq_n_f32(-in.half_height);
+    const float32x4_t zero = vdupq_n_f32(0.0f), one = vdupq_n_f32(1.0f);
+    const int32x4_t self = vdupq_n_s32(in.self);
+    float32x4_t off_x = zero, off_y = zero, away_x = zero, away_y = zero, head_x = zero, head_y = zero;
+
+    auto gather = [](const float* values, const int* n) {
+        float lanes[4] = {values[n[0]], values[n[1]], values[n[2]], values[n[3]]};
+        return vld1q_f32(lanes);
+    };
+
+    int k = 0;
+    for (; k + 4 <= in.count; k += 4) {
+        const int* n = in.neighbours + k;
+        int32x4_t idx = vld1q_s32(n);
+        float32x4_t dx = vsubq_f32(gather(in.pos_x, n), px);
+        float32x4_t dy = vsubq_f32(gather(in.pos_y, n), py);
+        dx = vbslq_f32(vcgtq_f32(dx, hw), vsubq_f32(dx, w), dx);
+        dx = vbslq_f32(vcltq_f32(dx, neg_hw), vaddq_f32(dx, w), dx);
+        dy = vbslq_f32(vcgtq_f32(dy, hh), vsubq_f32(dy, h), dy);
+        dy = vbslq_f32(vcltq_f32(dy, neg_hh), vaddq_f32(dy, h), dy);
+        off_x = vaddq_f32(off_x, dx);
+        off_y = vaddq_f32(off_y, dy);
+
+        uint32x4_t is_self = vceqq_s32(idx, self);
+        float32x4_t inv_d2 = vdivq_f32(one, vaddq_f32(vmulq_f32(dx, dx), vmulq_f32(dy, dy)));
+        away_x = vsubq_f32(away_x, vbslq_f32(is_self, zero, vmulq_f32(dx, inv_d2)));
+        away_y = vsubq_f32(away_y, vbslq_f32(is_self, zero, vmulq_f32(dy, inv_d2)));
+
+        float32x4_t hx = gather(in.head_x, n);
+        float32x4_t hy = gather(in.head_y, n);
+        uint32x4_t no_heading = vandq_u32(vceqq_f32(hx, zero), vceqq_f32(hy, zero));
+        head_x = vaddq_f32(head_x, vbslq_f32(no_heading, one, hx));
+        head_y = vaddq_f32(head_y, hy);
+    }
+
+    NeighbourSums sums;
+    sums.offset = {vaddvq_f32(off_x), vaddvq_f32(off_y)};
+    sums.away = {vaddvq_f32(away_x), vaddvq_f32(away_y)};
+    sums.heading = {vaddvq_f32(head_x), vaddvq_f32(head_y)};
+    for (; k < in.count; k++) {
+        addNeighbour(in, in.neighbours[k], sums);
+    }
+    return sums;
+}
+#endif
+
+// kernel selected by name ("auto" picks the best one supported by the CPU), nullptr if not available here
+inline NeighbourSumsKernel selectNeighbourSumsKernel(const string& name) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    bool avx2 = __builtin_cpu_supports("avx2");
+    bool sse42 = __builtin_cpu_supports("sse4.2");
+    if (name == "avx2" || (name == "auto" && avx2))
+        return avx2 ? neighbourSumsAvx2 : nullptr;
+    if (name == "sse4.2" || (name == "auto" && sse42))
+        return sse42 ? neighbourSumsSse42 : nullptr;
+#endif
+#if defined(__aarch64__)
+    if (name == "neon" || name == "auto")
+        return neighbourSumsNeon;
+#endif
+    if (name == "scalar" || name == "auto")
+        return neighbourSumsScalar;
+    return nullptr;
+}
+
+// kernel used by the fish update, set from the --simd option
+inline NeighbourSumsKernel neighbourSums = neighbourSumsScalar;
+
+
+// Morton (Z-order) code of a cell, interleaved bits of its coordinates (up to 16 bits each), cells close in the
+// scene mostly get close codes
+inline uint32_t mortonCode(uint32_t x, uint32_t y) {
+    auto spread = [](uint32_t v) {
+        v &= 0xffff;
+        v = (v | (v << 8)) & 0x00ff00ff;
+        v = (v | (v << 4)) & 0x0f0f0f0f;
+        v = (v | (v << 2)) & 0x33333333;
+        v = (v | (v << 1)) & 0x55555555;
+        return v;
+    };
+    return spread(x) | (spread(y) << 1);
+}
+
+// distance of `v` from the interval [lo, hi] on an axis of length `size` (over the border if `periodic`)
+// NaN for a NaN `v` (std::max and std::min keep their first argument if they cannot compare), so that the queries
+// of a NaN position visit nothing
+inline float intervalGap(float v, float lo, float hi, float size, bool periodic) {
+    float gap = std::max(std::max(lo - v, v - hi), 0.f);
+    if (periodic) {
+        gap = std::min({gap, std::max(std::max(lo - size - v, v - hi + size), 0.f),
+                        std::max(std::max(lo + size - v, v - hi - size), 0.f)});
+    }
+    return gap;
+}
+
+
+// uniform grid over the scene (cell-linked list), used to answer radius queries without scanning all entities
+// cells are at least `cell_dist` wide, so the query of radius R only has to visit cells up to ceil(R / cell size) away
+// entities are referenced by their index in the owning container, positions are kept by the owner
+// if `periodic`, the grid wraps around and cells over the border are visited as ghost cells of the opposite side
+class SpatialGrid {
+public:
+    const int cols, rows;
+    const float cell_width, cell_height;
+    const bool periodic;
+
+    SpatialGrid(int width, int height, int cell_dist, bool periodic)
+        : cols(std::max(1, width / cell_dist)), rows(std::max(1, height / cell_dist)),
+          cell_width((float)width / cols), cell_height((float)height / rows), periodic(periodic),
+          head(cols * rows, -1) {}
+
+    // drop all entities and prepare the grid for `num_entities` indices
+    void clear(size_t num_entities) {
+        std::fill(head.begin(), head.end(), -1);
+        next.assign(num_entities, -1);
+        prev.assign(num_entities, -1);
+        cell_of.assign(num_entities, -1);
+    }
+
+    void insert(int i, glm::vec2 pos) {
+        int c = cellIndex(pos);
+        next[i] = head[c];
+        prev[i] = -1;
+        if (head[c] != -1)
+            prev[head[c]] = i;
+        head[c] = i;
+        cell_of[i] = c;
+    }
+
+    void remove(int i) {
+        int c = cell_of[i];
+        if (c == -1)
+            return;
+        if (prev[i] != -1)
+            next[prev[i]] = next[i];
+        else
+            head[c] = next[i];
+        if (next[i] != -1)
+            prev[next[i]] = prev[i];
+        next[i] = prev[i] = cell_of[i] = -1;
+    }
+
+    // re-link the entity only if it changed its cell
+    void move(int i, glm::vec2 pos) {
+        if (cell_of[i] == cellIndex(pos))
+            return;
+        remove(i);
+        insert(i, pos);
+    }
+
+    // column and row of the cell of a position
+    glm::ivec2 cellOf(glm::vec2 pos) const {
+        return {cellCoord(pos.x, cell_width, cols), cellCoord(pos.y, cell_height, rows)};
+    }
+
+    // call `f(i)` for every entity in cells that intersect the square around `pos` with half-side `radius`
+    // this is only a broad phase, the exact distance check (see `sceneOffset`) is up to the caller
+    template<typename F>
+    void forEachCandidate(glm::vec2 pos, float radius, F f) const {
+        int x_lo, x_hi, y_lo, y_hi;
+        cellRange(pos.x - radius, pos.x + radius, cell_width, cols, x_lo, x_hi);
+        cellRange(pos.y - radius, pos.y + radius, cell_height, rows, y_lo, y_hi);
+        for (int y = y_lo; y <= y_hi; y++) {
+            int row = wrapCoord(y, rows) * cols;
+            for (int x = x_lo; x <= x_hi; x++) {
+                for (int i = head[row + wrapCoord(x, cols)]; i != -1; i = next[i]) {
+                    f(i);
+                }
+            }
+        }
+    }
+
+    // like forEachCandidate, but the cells go ring by ring from the cell of `pos`, and `f(i)` returns the squared
+    // distance beyond which the caller needs no more candidates, cells farther than that are skipped (k-nearest
+    // queries, see `NearestNeighbours`)
+    template<typename F>
+    void forEachCandidateNearFirst(glm::vec2 pos, float radius, F f) const {
+        int x_lo, x_hi, y_lo, y_hi;
+        cellRange(pos.x - radius, pos.x + radius, cell_width, cols, x_lo, x_hi);
+        cellRange(pos.y - radius, pos.y + radius, cell_height, rows, y_lo, y_hi);
+        int cx = std::clamp((int)std::floor(pos.x / cell_width), x_lo, x_hi);
+        int cy = std::clamp((int)std::floor(pos.y / cell_height), y_lo, y_hi);
+        int rings = std::max({cx - x_lo, x_hi - cx, cy - y_lo, y_hi - cy});
+        float bound = radius * radius;
+        for (int r = 0; r <= rings; r++) {
+            for (int y = std::max(y_lo, cy - r); y <= std::min(y_hi, cy + r); y++) {
+                int row = wrapCoord(y, rows);
+                float gap_y = intervalGap(pos.y, cellLow(row, cell_height), cellHigh(row, cell_height, rows),
+                                          rows * cell_height, periodic);
+                // only the border of the ring, its inside was visited before
+                int step = (y == cy - r || y == cy + r) ? 1 : 2 * r;
+                for (int x = cx - r; x <= cx + r; x += std::max(step, 1)) {
+                    if (x < x_lo || x > x_hi)
+                        continue;
+                    int col = wrapCoord(x, cols);
+                    float gap_x = intervalGap(pos.x, cellLow(col, cell_width), cellHigh(col, cell_width, cols),
+                                              cols * cell_width, periodic);
+                    if (!(gap_x * gap_x + gap_y * gap_y <= bound))
+                        continue;
+                    for (int i = head[row * cols + col]; i != -1; i = next[i]) {
+                        bound = f(i);
+                    }
+                }
+            }
+        }
+    }
+
+private:
+    vector<int> head;                   // first entity in each cell, -1 if empty
+    vector<int> next;                   // next entity in the same cell
+    vector<int> prev;                   // previous entity in the same cell (for O(1) removal)
+    vector<int> cell_of;                // cell of each entity, -1 if it is not in the grid
+
+    // positions outside the scene (e.g. shark mouth) are clamped to the border cells, or wrapped if periodic
+    int cellCoord(float v, float cell_size, int num_cells) const {
+        return wrapCoord((int)std::floor(v / cell_size), num_cells);
+    }
+
+    // extent of a cell on one axis, the border cells of a non-periodic grid also hold everything beyond the border
+    float cellLow(int c, float cell_size) const {
+        return c == 0 && !periodic ? -INFINITY : c * cell_size;
+    }
+
+    float cellHigh(int c, float cell_size, int num_cells) const {
+        return c == num_cells - 1 && !periodic ? INFINITY : (c + 1) * cell_size;
+    }
+
+    int wrapCoord(int c, int num_cells) const {
+        if (periodic)
+            return ((c % num_cells) + num_cells) % num_cells;
+        return std::clamp(c, 0, num_cells - 1);
+    }
+
+    // range of (possibly ghost) cell coordinates covering [lo, hi], each real cell is visited at most once
+    void cellRange(float lo, float hi, float cell_size, int num_cells, int& c_lo, int& c_hi) const {
+        c_lo = (int)std::floor(lo / cell_size);
+        c_hi = (int)std::floor(hi / cell_size);
+        if (!periodic) {
+            c_lo = std::clamp(c_lo, 0, num_cells - 1);
+            c_hi = std::clamp(c_hi, 0, num_cells - 1);
+        } else if (c_hi - c_lo + 1 >= num_cells) {
+            c_lo = 0;
+            c_hi = num_cells - 1;
+        }
+    }
+
+    int cellIndex(glm::vec2 pos) const {
+        return cellCoord(pos.y, cell_height, rows) * cols + cellCoord(pos.x, cell_width, cols);
+    }
+};
+
+
+// bump allocator for scratch data that lives for one step only (query results)
+// memory comes from blocks that are kept between steps, so after the first step no heap allocations are needed
+// values are collected into one span at a time (begin, push..., end), returned spans stay valid until reset()
+template<typename T>
+class ScratchArena {
+public:
+    static constexpr size_t BLOCK_SIZE = 4096;
+
+    // release everything allocated so far (but keep the memory)
+    void reset() {
+        block = used = start = 0;
+    }
+
+    // start collecting a new span
+    void begin() {
+        start = used;
+    }
+
+    void push(T value) {
+        if (blocks.empty() || used == blocks[block].size())
+            grow();
+        blocks[block][used++] = value;
+    }
+
+    // finish the span collected since begin()
+    std::span<const T> end() const {
+        if (blocks.empty())
+            return {};
+        return std::span<const T>(blocks[block].data() + start, used - start);
+    }
+
+private:
+    vector<vector<T>> blocks;
+    size_t block = 0;   // block we allocate from at the moment
+    size_t used = 0;    // number of used values in that block
+    size_t start = 0;   // start of the span being collected
+
+    // continue in the next block, moving there the part of the span collected so far
+    void grow() {
+        size_t len = used - start;
+        size_t next = blocks.empty() ? 0 : block + 1;
+        if (next == blocks.size())
+            blocks.emplace_back();
+        size_t needed = std::max(BLOCK_SIZE, 2 * (len + 1));
+        if (blocks[next].size() < needed)
+            blocks[next].resize(needed);
+        if (len > 0)
+            std::copy(blocks[block].begin() + start, blocks[block].begin() + used, blocks[next].begin());
+        block = next;
+        start = 0;
+        used = len;
+    }
+};
+
+
+// the k entities nearest to a point out of those offered to it, a max-heap of at most `Capacity` entries by the squared
+// distance (ties by id), so the work and memory per query are bounded however many entities are offered
+// the capacity is fixed at compile time, so nothing is allocated, k is chosen at runtime up to it
+template<int Capacity>
+class NearestNeighbours {
+public:
+    // forget the entities offered so far, keep the k nearest of those within `radius` from now on
+    void reset(int k, float radius) {
+        this->k = std::clamp(k, 1, Capacity);
+        size = 0;
+        radius2 = radius * radius;
+    }
+
+    // squared distance of the entities that could still be kept (the farthest kept one once the heap is full)
+    float bound() const {
+        return size == k ? heap[0].dist2 : radius2;
+    }
+
+    // `i` is the index of the entity in its container, `id` orders the entities at the same distance
+    void offer(float dist2, int id, int i) {
+        // (written so that NaN distances are never kept)
+        if (!(dist2 <= radius2))
+            return;
+        Entry entry{dist2, id, i};
+        if (size < k) {
+            heap[size++] = entry;
+            std::push_heap(heap, heap + size);
+        } else if (entry < heap[0]) {
+            std::pop_heap(heap, heap + size);
+            heap[size - 1] = entry;
+            std::push_heap(heap, heap + size);
+        }
+    }
+
+    // call `f(i)` for the kept entities from the nearest one (the heap is emptied)
+    template<typename F>
+    void forEachNearest(F f) {
+        std::sort_heap(heap, heap + size);
+        for (int j = 0; j < size; j++)
+            f(heap[j].i);
+        size = 0;
+    }
+
+private:
+    struct Entry {
+        float dist2;
+        int id;
+        int i;
+
+        bool operator<(const Entry& other) const {
+            return dist2 != other.dist2 ? dist2 < other.dist2 : id < other.id;
+        }
+    };
+
+    Entry heap[Capacity];
+    int k = 1;
+    int size = 0;
+    float radius2 = 0;
+};
+
+
+// state of a group of entities (fish, sharks or food) stored as a structure of arrays
+// every field is contiguous, so that the hot loops only stream the fields they actually use
+struct EntityStore {
+    vector<float> pos_x, pos_y;
+    vector<float> dir_x, dir_y;
+    vector<float> head_x, head_y;   // unit heading (normalized direction, zero for zero direction), kept by setDir
+    vector<int> id;
+    vector<int> fear_steps;         // only used by fish
+    vector<unsigned char> alive;    // alive fish, or food that was not eaten yet
+
+    size_t size() const { return id.size(); }
+
+    // append a new entity and return its slot
+    int add(int entity_id, glm::vec2 pos, glm::vec2 dir) {
+        pos_x.push_back(pos.x);
+        pos_y.push_back(pos.y);
+        dir_x.push_back(dir.x);
+        dir_y.push_back(dir.y);
+        head_x.push_back(0);
+        head_y.push_back(0);
+        id.push_back(entity_id);
+        fear_steps.push_back(0);
+        alive.push_back(1);
+        setDir((int)size() - 1, dir);
+        return (int)size() - 1;
+    }
+
+    // reuse an existing slot for a new entity
+    void reset(int i, int entity_id, glm::vec2 pos, glm::vec2 dir) {
+        setPos(i, pos);
+        setDir(i, dir);
+        id[i] = entity_id;
+        fear_steps[i] = 0;
+        alive[i] = 1;
+    }
+
+    glm::vec2 pos(int i) const { return {pos_x[i], pos_y[i]}; }
+    glm::vec2 dir(int i) const { return {dir_x[i], dir_y[i]}; }
+    void setPos(int i, glm::vec2 p) { pos_x[i] = p.x; pos_y[i] = p.y; }
+    glm::vec2 heading(int i) const { return {head_x[i], head_y[i]}; }
+
+    void setDir(int i, glm::vec2 d) {
+        dir_x[i] = d.x;
+        dir_y[i] = d.y;
+        glm::vec2 h = (d.x != 0 || d.y != 0) ? d * inverseLength(d) : glm::vec2(0);
+        head_x[i] = h.x;
+        head_y[i] = h.y;
+    }
+
+    // the entities of `from` reordered, slot k gets the entity of slot order[k]
+    void gather(const EntityStore& from, std::span<const int> order) {
+        auto field = [&](auto& to, const auto& values) {
+            to.resize(order.size());
+            for (size_t k = 0; k < order.size(); k++)
+                to[k] = values[order[k]];
+        };
+        field(pos_x, from.pos_x);
+        field(pos_y, from.pos_y);
+        field(dir_x, from.dir_x);
+        field(dir_y, from.dir_y);
+        field(head_x, from.head_x);
+        field(head_y, from.head_y);
+        field(id, from.id);
+        field(fear_steps, from.fear_steps);
+        field(alive, from.alive);
+    }
+};
+
+
+// Verlet neighbour lists: the entities within `radius + skin` of every entity, kept over several steps
+// while no entity moved more than skin / 2 since the build, any two entities within `radius` of each other now
+// were within `radius + skin` then, so the lists still hold all neighbours (the exact distance check is up to
+// the caller, as with SpatialGrid)
+// lists are stored back to back (CSR), entities are referenced by their slot in the store
+class VerletLists {
+public:
+    bool empty() const { return start.empty(); }
+
+    // candidates of the entity in slot `i` (alive when the lists were built, may have died since)
+    std::span<const int> candidates(int i) const {
+        return {items.data() + start[i], items.data() + start[i + 1]};
+    }
+
+    // lists of the alive entities of `store` within `reach`, distances are taken in the scene of `C` (see
+    // `sceneOffset`)
+    // the entities are first sorted into cells at least `reach` wide (counting sort), so the candidates of an
+    // entity are the contiguous runs of the 3x3 cells around its cell, within a cell they keep the given order of
+    // slots (the order of ids makes the lists independent of the slots, like the grid)
+    template<typename C>
+    void build(const EntityStore& store, float reach, std::span<const int> order) {
+        int cols = std::max(1, (int)(C::width / reach));
+        int rows = std::max(1, (int)(C::height / reach));
+        float cell_width = (float)C::width / cols;
+        float cell_height = (float)C::height / rows;
+        auto cellCoord = [](float v, float cell_size, int num_cells) {
+            return std::clamp((int)std::floor(v / cell_size), 0, num_cells - 1);
+        };
+
+        cell_start.assign(cols * rows + 1, 0);
+        cell_of.assign(store.size(), -1);
+        for (size_t i = 0; i < store.size(); i++) {
+            if (store.alive[i]) {
+                cell_of[i] = cellCoord(store.pos_y[i], cell_height, rows) * cols +
+                             cellCoord(store.pos_x[i], cell_width, cols);
+                cell_start[cell_of[i] + 1]++;
+            }
+        }
+        for (int c = 0; c < cols * rows; c++)
+            cell_start[c + 1] += cell_start[c];
+        sorted_x.resize(cell_start.back());
+        sorted_y.resize(cell_start.back());
+        sorted_slot.resize(cell_start.back());
+        cell_fill.assign(cell_start.begin(), cell_start.end() - 1);
+        for (int i : order) {
+            if (cell_of[i] < 0)
+                continue;
+            int k = cell_fill[cell_of[i]]++;
+            sorted_x[k] = store.pos_x[i];
+            sorted_y[k] = store.pos_y[i];
+            sorted_slot[k] = i;
+        }
+
+        // cells next to cell `c` (and itself) in one axis, each one once, wrapped around if the scene wraps
+        auto around = [](int c, int num_cells, int* out) {
+            int n = 0;
+            if (num_cells < 3) {
+                for (int k = 0; k < num_cells; k++)
+                    out[n++] = k;
+                return n;
+            }
+            for (int k = c - 1; k <= c + 1; k++) {
+                if (!C::wall)
+                    out[n++] = (k + num_cells) % num_cells;
+                else if (k >= 0 && k < num_cells)
+                    out[n++] = k;
+            }
+            return n;
+        };
+
+        start.assign(1, 0);
+        items.clear();
+        for (size_t i = 0; i < store.size(); i++) {
+            if (cell_of[i] >= 0) {
+                glm::vec2 pos = store.pos((int)i);
+                int xs[3], ys[3];
+                int num_x = around(cell_of[i] % cols, cols, xs);
+                int num_y = around(cell_of[i] / cols, rows, ys);
+                for (int y = 0; y < num_y; y++) {
+                    for (int x = 0; x < num_x; x++) {
+                        int c = ys[y] * cols + xs[x];
+                        for (int k = cell_start[c]; k < cell_start[c + 1]; k++) {
+                            if (glm::length2(sceneOffset<C>(pos, glm::vec2(sorted_x[k], sorted_y[k]))) <= reach * reach)
+                                items.push_back(sorted_slot[k]);
+                        }
+                    }
+                }
+            }
+            start.push_back((int)items.size());
+        }
+        built_x = store.pos_x;
+        built_y = store.pos_y;
+    }
+
+    // the entities moved to other slots, slot `k` now holds the entity of the old slot `order[k]`, the lists keep
+    // their candidates in the same order, so moving the entities changes neither them nor when they are rebuilt
+    void reorder(std::span<const int> order) {
+        if (empty())
+            return;
+        slot_of.resize(order.size());
+        for (size_t k = 0; k < order.size(); k++)
+            slot_of[order[k]] = (int)k;
+        reordered_start.assign(1, 0);
+        reordered_items.clear();
+        reordered_x.resize(order.size());
+        reordered_y.resize(order.size());
+        for (size_t k = 0; k < order.size(); k++) {
+            for (int i : candidates(order[k]))
+                reordered_items.push_back(slot_of[i]);
+            reordered_start.push_back((int)reordered_items.size());
+            reordered_x[k] = built_x[order[k]];
+            reordered_y[k] = built_y[order[k]];
+        }
+        start.swap(reordered_start);
+        items.swap(reordered_items);
+        built_x.swap(reordered_x);
+        built_y.swap(reordered_y);
+    }
+
+    // distance the entity in slot `i` moved since the build
+    template<typename C>
+    float displacement(int i, const EntityStore& store) const {
+        return glm::length(sceneOffset<C>(glm::vec2(built_x[i], built_y[i]), store.pos(i)));
+    }
+
+    // largest distance an alive entity moved since the build
+    template<typename C>
+    float maxDisplacement(const EntityStore& store) const {
+        float max_dist = 0;
+        for (size_t i = 0; i < store.size(); i++) {
+            if (store.alive[i])
+                max_dist = std::max(max_dist, displacement<C>((int)i, store));
+        }
+        return max_dist;
+    }
+
+private:
+    vector<int> start;              // list of entity i is items[start[i] .. start[i + 1])
+    vector<int> items;
+    vector<float> built_x, built_y; // positions at the build
+
+    // entities sorted by cells for the build, kept so that rebuilds do not allocate
+    vector<int> cell_of, cell_start, cell_fill, sorted_slot;
+    vector<float> sorted_x, sorted_y;
+
+    // the lists in the new slots while reordering
+    vector<int> slot_of, reordered_start, reordered_items;
+    vector<float> reordered_x, reordered_y;
+};
+
+
+// adaptive quadtree over the scene, an alternative to SpatialGrid for strongly clustered entities, where the cells
+// of a uniform grid get crowded: the entities are sorted by the Morton code of their position and every node with
+// more than LEAF_SIZE entities is split into its non-empty quadrants, so dense regions get small nodes and empty
+// regions none
+// nodes keep the bounding boxes of their entities (a BVH of quadrants), an entity moved after the build widens the
+// boxes of its leaf and the nodes above it, removed entities are skipped, so the tree stays valid until the next build
+// entities are referenced by their slot, candidates come in the Morton order (ties by entity id), not by slot
+class QuadTree {
+public:
+    static constexpr int LEAF_SIZE = 8;
+    static constexpr int MAX_DEPTH = 16;   // Morton codes have 16 bits per axis
+    static constexpr int QUEUE_SIZE = 64;  // nodes waiting in a nearest-first query
+
+    const float width, height;
+    const bool periodic;
+
+    QuadTree(int width, int height, bool periodic) : width((float)width), height((float)height), periodic(periodic) {}
+
+    // index of the alive entities of `store`, the codes are computed in parallel if `parallel`
+    void build(const EntityStore& store, [[maybe_unused]] bool parallel) {
+        sorted.resize(store.size());
+#ifdef _OPENMP
+        #pragma omp parallel for if(parallel)
+#endif
+        for (int i = 0; i < (int)store.size(); i++) {
+            uint32_t x = (uint32_t)std::clamp((int)(store.pos_x[i] / width * 65536), 0, 65535);
+            uint32_t y = (uint32_t)std::clamp((int)(store.pos_y[i] / height * 65536), 0, 65535);
+            // dead entities get a key after all the others and are cut off below
+            uint64_t key = (uint64_t)mortonCode(x, y) << 32 | (uint32_t)store.id[i];
+            sorted[i] = {store.alive[i] ? key : UINT64_MAX, i};
+        }
+        std::sort(sorted.begin(), sorted.end());
+        size_t n = std::partition_point(sorted.begin(), sorted.end(),
+                                        [](const auto& e) { return e.first != UINT64_MAX; }) - sorted.begin();
+
+        items.resize(n);
+        item_x.resize(n);
+        item_y.resize(n);
+        item_leaf.resize(n);
+        item_of.assign(store.size(), -1);
+        for (size_t k = 0; k < n; k++) {
+            int i = sorted[k].second;
+            items[k] = i;
+            item_x[k] = store.pos_x[i];
+            item_y[k] = store.pos_y[i];
+            item_of[i] = (int)k;
+        }
+
+        // nodes breadth first, so the children of a node are next to each other and after it
+        nodes.assign(1, Node{0, (int)n, 0, -1, -1, 0});
+        for (size_t v = 0; v < nodes.size(); v++) {
+            Node node = nodes[v];
+            if (node.end - node.begin <= LEAF_SIZE || node.depth == MAX_DEPTH)
+                continue;
+            int shift = 62 - 2 * node.depth;   // quadrant bits of the children in the key
+            nodes[v].first_child = (int)nodes.size();
+            for (int begin = node.begin; begin < node.end; ) {
+                uint64_t quadrant = (sorted[begin].first >> shift) & 3;
+                int end = (int)(std::partition_point(sorted.begin() + begin, sorted.begin() + node.end, [&](const auto& e) {
+                    return ((e.first >> shift) & 3) == quadrant;
+                }) - sorted.begin());
+                nodes.push_back(Node{begin, end, node.depth + 1, (int)v, -1, 0});
+                nodes[v].num_children++;
+                begin = end;
+            }
+        }
+
+        // bounding boxes bottom up, leaves from their entities
+        for (size_t v = nodes.size(); v-- > 0; ) {
+            Node& node = nodes[v];
+            node.box = Box::empty();
+            if (node.num_children == 0) {
+                for (int k = node.begin; k < node.end; k++) {
+                    node.box.add(item_x[k], item_y[k]);
+                    item_leaf[k] = (int)v;
+                }
+            } else {
+                for (int c = node.first_child; c < node.first_child + node.num_children; c++)
+                    node.box.add(nodes[c].box);
+            }
+        }
+    }
+
+    void remove(int i) {
+        if (item_of[i] < 0)
+            return;
+        items[item_of[i]] = -1;
+        item_of[i] = -1;
+    }
+
+    // the entity moved, the boxes up from its leaf are widened to hold it
+    void move(int i, glm::vec2 pos) {
+        int k = item_of[i];
+        if (k < 0)
+            return;
+        item_x[k] = pos.x;
+        item_y[k] = pos.y;
+        for (int v = item_leaf[k]; v >= 0 && !nodes[v].box.contains(pos.x, pos.y); v = nodes[v].parent)
+            nodes[v].box.add(pos.x, pos.y);
+    }
+
+    // call `f(i)` for every entity within the square around `pos` with half-side `radius` (over the border if the
+    // tree is periodic), this is only a broad phase like SpatialGrid, the exact distance check is up to the caller
+    template<typename F>
+    void forEachCandidate(glm::vec2 pos, float radius, F f) const {
+        if (nodes.empty() || nodes[0].begin == nodes[0].end)
+            return;
+        // the square, split into its parts inside the scene if it wraps around (the parts do not overlap, so no
+        // entity is found twice)
+        Interval parts_x[2], parts_y[2];
+        int num_x = split(pos.x - radius, pos.x + radius, width, parts_x);
+        int num_y = split(pos.y - radius, pos.y + radius, height, parts_y);
+        for (int a = 0; a < num_y; a++) {
+            for (int b = 0; b < num_x; b++)
+                visit(Box{parts_x[b].lo, parts_y[a].lo, parts_x[b].hi, parts_y[a].hi}, f);
+        }
+    }
+
+    // like forEachCandidate, but the nodes go nearest first, and `f(i)` returns the squared distance beyond which the
+    // caller needs no more candidates, nodes farther than that are skipped (k-nearest queries, see
+    // `NearestNeighbours`), all entities of a visited leaf are candidates
+    // the nodes wait in a fixed-size priority queue, a node that does not fit in it is searched right away
+    template<typename F>
+    void forEachCandidateNearFirst(glm::vec2 pos, float radius, F f) const {
+        if (nodes.empty() || nodes[0].begin == nodes[0].end)
+            return;
+        float bound = radius * radius;
+        std::pair<float, int> queue[QUEUE_SIZE];   // (squared distance, node), the nearest on top
+        int size = 0;
+        queue[size++] = {distance2(nodes[0].box, pos), 0};
+        while (size > 0) {
+            std::pop_heap(queue, queue + size, std::greater<>());
+            auto [dist2, v] = queue[--size];
+            if (!(dist2 <= bound))
+                break;   // the rest is even farther
+            const Node& node = nodes[v];
+            if (node.num_children == 0) {
+                bound = visitLeaf(node, bound, f);
+                continue;
+            }
+            for (int c = node.first_child; c < node.first_child + node.num_children; c++) {
+                float child_dist2 = distance2(nodes[c].box, pos);
+                if (!(child_dist2 <= bound))
+                    continue;
+                if (size == QUEUE_SIZE) {
+                    bound = visitDepthFirst(c, pos, bound, f);
+                    continue;
+                }
+                queue[size++] = {child_dist2, c};
+                std::push_heap(queue, queue + size, std::greater<>());
+            }
+        }
+    }
+
+private:
+    struct Box {
+        float min_x, min_y, max_x, max_y;
+
+        static Box empty() { return {INFINITY, INFINITY, -INFINITY, -INFINITY}; }
+        void add(float x, float y) {
+            min_x = std::min(min_x, x);
+            min_y = std::min(min_y, y);
+            max_x = std::max(max_x, x);
+            max_y = std::max(max_y, y);
+        }
+        void add(const Box& b) {
+            min_x = std::min(min_x, b.min_x);
+            min_y = std::min(min_y, b.min_y);
+            max_x = std::max(max_x, b.max_x);
+            max_y = std::max(max_y, b.max_y);
+        }
+        bool contains(float x, float y) const { return x >= min_x && x <= max_x && y >= min_y && y <= max_y; }
+        bool overlaps(const Box& b) const {
+            return b.min_x <= max_x && b.max_x >= min_x && b.min_y <= max_y && b.max_y >= min_y;
+        }
+    };
+
+    struct Node {
+        int begin, end;        // range of the entities in `items`
+        int depth;
+        int parent;
+        int first_child;       // children are nodes[first_child .. first_child + num_children), none for a leaf
+        int num_children;
+        Box box = Box::empty();
+    };
+
+    vector<std::pair<uint64_t, int>> sorted;   // (Morton code, id) and slot of the entities, for the build
+    vector<Node> nodes;
+    vector<int> items;                         // slots in Morton order (-1 once removed), nodes are ranges of them
+    vector<float> item_x, item_y;              // positions of the items, kept up to date by `move`
+    vector<int> item_leaf;                     // leaf node of every item
+    vector<int> item_of;                       // item of every slot, -1 if not in the tree
+
+    struct Interval {
+        float lo, hi;
+    };
+
+    // squared distance of a point from the box (over the border if the tree is periodic)
+    float distance2(const Box& box, glm::vec2 pos) const {
+        float gap_x = intervalGap(pos.x, box.min_x, box.max_x, width, periodic);
+        float gap_y = intervalGap(pos.y, box.min_y, box.max_y, height, periodic);
+        return gap_x * gap_x + gap_y * gap_y;
+    }
+
+    // parts of [lo, hi] on one axis of the scene: itself, or its pieces on both sides of a periodic border
+    int split(float lo, float hi, float size, Interval* parts) const {
+        if (!periodic) {
+            parts[0] = {lo, hi};
+            return 1;
+        }
+        if (hi - lo >= size) {
+            parts[0] = {0, size};
+            return 1;
+        }
+        // the interval moved to start inside the scene (the query point may be outside, e.g. a shark's mouth)
+        float shift = std::floor(lo / size) * size;
+        lo -= shift;
+        hi -= shift;
+        if (hi >= size) {
+            parts[0] = {lo, size};
+            parts[1] = {0, hi - size};
+            return 2;
+        }
+        parts[0] = {lo, hi};
+        return 1;
+    }
+
+    template<typename F>
+    float visitLeaf(const Node& node, float bound, F& f) const {
+        for (int k = node.begin; k < node.end; k++) {
+            if (items[k] >= 0)
+                bound = f(items[k]);
+        }
+        return bound;
+    }
+
+    // nearest-first query of the subtree of `root`, depth first, returns the new bound
+    template<typename F>
+    float visitDepthFirst(int root, glm::vec2 pos, float bound, F& f) const {
+        int stack[4 * MAX_DEPTH + 4];
+        int top = 0;
+        stack[top++] = root;
+        while (top > 0) {
+            const Node& node = nodes[stack[--top]];
+            if (!(distance2(node.box, pos) <= bound))
+                continue;
+            if (node.num_children == 0) {
+                bound = visitLeaf(node, bound, f);
+                continue;
+            }
+            for (int c = node.first_child + node.num_children - 1; c >= node.first_child; c--)
+                stack[top++] = c;
+        }
+        return bound;
+    }
+
+    template<typename F>
+    void visit(const Box& query, F& f) const {
+        int stack[4 * MAX_DEPTH + 4];
+        int top = 0;
+        stack[top++] = 0;
+        while (top > 0) {
+            const Node& node = nodes[stack[--top]];
+            if (!node.box.overlaps(query))
+                continue;
+            if (node.num_children == 0) {
+                for (int k = node.begin; k < node.end; k++) {
+                    if (items[k] >= 0 && query.contains(item_x[k], item_y[k]))
+                        f(items[k]);
+                }
+                continue;
+            }
+            for (int c = node.first_child + node.num_children - 1; c >= node.first_child; c--)
+                stack[top++] = c;
+        }
+    }
+};
+
+
+// neighbourhood of one fish summed from the cell aggregates of a MeanFieldGrid, in the terms of NeighbourSums
+struct MeanFieldSums {
+    float count = 0;        // number of fish (including the fish itself)
+    glm::vec2 offset{0};    // sum of their offsets from the fish
+    glm::vec2 heading{0};   // sum of their unit headings (zero heading counts as (1, 0))
+    glm::vec2 far_away{0};  // separation sum of the fish beyond the close distance, taken at the centroids of the cells
+};
+
+// aggregates of fish in the cells of a uniform grid: count, sum of positions and sum of headings
+// mean-field approximation of the neighbourhood: the fish in the cells whose centre is within the radius are taken
+// as the neighbours, and they are summed cell by cell, so a query costs the same however many fish are around
+// the separation of the cells whose centroid is beyond the close distance is taken as if all their fish were at the
+// centroid, the closer fish are left to the exact pairs
+// positions are summed relative to the cell centre, so the sums stay precise and a cell needs one periodic offset
+class MeanFieldGrid {
+public:
+    const int cols, rows;
+    const float cell_width, cell_height;
+    const bool periodic;
+
+    MeanFieldGrid(int width, int height, float cell_dist, bool periodic)
+        : cols(std::max(1, (int)(width / cell_dist))), rows(std::max(1, (int)(height / cell_dist))),
+          cell_width((float)width / cols), cell_height((float)height / rows), periodic(periodic),
+          cells(cols * rows) {}
+
+    // aggregates of the alive entities of `store`, added in the given order of slots (the float sums depend on it)
+    void build(const EntityStore& store, std::span<const int> order) {
+        std::fill(cells.begin(), cells.end(), Cell{});
+        for (int i : order) {
+            if (store.alive[i])
+                add(store.pos(i), {store.head_x[i], store.head_y[i]}, 1);
+        }
+    }
+
+    // an entity moved (and turned) after the build
+    void move(glm::vec2 from, glm::vec2 from_head, glm::vec2 to, glm::vec2 to_head) {
+        add(from, from_head, -1);
+        add(to, to_head, 1);
+    }
+
+    MeanFieldSums sums(glm::vec2 pos, float radius, float close) const {
+        int x_lo, x_hi, y_lo, y_hi;
+        cellRange(pos.x - radius, pos.x + radius, cell_width, cols, x_lo, x_hi);
+        cellRange(pos.y - radius, pos.y + radius, cell_height, rows, y_lo, y_hi);
+        MeanFieldSums sums;
+        for (int y = y_lo; y <= y_hi; y++) {
+            int row = wrapCoord(y, rows);
+            float dy = centreOffset(pos.y, row, cell_height, rows);
+            for (int x = x_lo; x <= x_hi; x++) {
+                int col = wrapCoord(x, cols);
+                float dx = centreOffset(pos.x, col, cell_width, cols);
+                const Cell& cell = cells[row * cols + col];
+                if (cell.count == 0 || dx * dx + dy * dy > radius * radius)
+                    continue;
+                glm::vec2 offset(cell.off_x + cell.count * dx, cell.off_y + cell.count * dy);
+                sums.count += cell.count;
+                sums.offset += offset;
+                sums.heading += glm::vec2(cell.head_x, cell.head_y);
+                glm::vec2 centroid = offset / cell.count;
+                float dist2 = glm::length2(centroid);
+                if (dist2 > close * close)
+                    sums.far_away -= cell.count * centroid / dist2;
+            }
+        }
+        return sums;
+    }
+
+private:
+    struct Cell {
+        float count = 0;
+        float off_x = 0, off_y = 0;     // sum of positions relative to the centre of the cell
+        float head_x = 0, head_y = 0;
+    };
+    vector<Cell> cells;
+
+    void add(glm::vec2 pos, glm::vec2 head, float sign) {
+        int col = wrapCoord((int)std::floor(pos.x / cell_width), cols);
+        int row = wrapCoord((int)std::floor(pos.y / cell_height), rows);
+        Cell& cell = cells[row * cols + col];
+        if (head.x == 0 && head.y == 0)
+            head = {1, 0};
+        cell.count += sign;
+        cell.off_x += sign * (pos.x - (col + 0.5f) * cell_width);
+        cell.off_y += sign * (pos.y - (row + 0.5f) * cell_height);
+        cell.head_x += sign * head.x;
+        cell.head_y += sign * head.y;
+    }
+
+    // offset of the centre of a cell from `v` (to its nearest periodic image)
+    float centreOffset(float v, int c, float cell_size, int num_cells) const {
+        float d = (c + 0.5f) * cell_size - v;
+        float size = num_cells * cell_size;
+        if (periodic) {
+            if (d > size / 2) d -= size;
+            else if (d < -size / 2) d += size;
+        }
+        return d;
+    }
+
+    // positions outside the scene are clamped to the border cells, or wrapped if periodic (as in SpatialGrid)
+    int wrapCoord(int c, int num_cells) const {
+        if (periodic)
+            return ((c % num_cells) + num_cells) % num_cells;
+        return std::clamp(c, 0, num_cells - 1);
+    }
+
+    void cellRange(float lo, float hi, float cell_size, int num_cells, int& c_lo, int& c_hi) const {
+        c_lo = (int)std::floor(lo / cell_size);
+        c_hi = (int)std::floor(hi / cell_size);
+        if (!periodic) {
+            c_lo = std::clamp(c_lo, 0, num_cells - 1);
+            c_hi = std::clamp(c_hi, 0, num_cells - 1);
+        } else if (c_hi - c_lo + 1 >= num_cells) {
+            c_lo = 0;
+            c_hi = num_cells - 1;
+        }
+    }
+};
+
+
+// lightweight view of one entity (its slot in the EntityStore), Fish, Shark and Food are built on top of it
+class EntityView {
+public:
+    EntityStore* store;
+    int slot;
+
+    EntityView(EntityStore& store, int slot) : store(&store), slot(slot) {}
+
+    int id() const { return store->id[slot]; }
+    glm::vec2 pos() const { return store->pos(slot); }
+    glm::vec2 dir() const { return store->dir(slot); }
+    void setPos(glm::vec2 p) const { store->setPos(slot, p); }
+    void setDir(glm::vec2 d) const { store->setDir(slot, d); }
+};
+
+
+template<typename C>
+class Food : public EntityView {
+public:
+    using EntityView::EntityView;
+
+    // create a new piece of food at a random place, either in a new slot or in the given (freed) one
+    static Food spawn(EntityStore& store, int id, RandomStream rng, int slot = -1) {
+        glm::vec2 pos = getRandomPlace<C>(rng);
+        if (slot < 0) {
+            slot = store.add(id, pos, glm::vec2(0));
+        } else {
+            store.reset(slot, id, pos, glm::vec2(0));
+        }
+        return Food(store, slot);
+    }
+
+    bool eaten() const { return !store->alive[slot]; }
+
+    // TODO: How do we want the food to flow? - for now, just randomly drifts a bit
+    void step(RandomStream rng) const {
+        // when it is dead, do nothing
+        if (eaten())
+            return;
+
+        glm::vec2 pos = this->pos();
+        glm::vec2 dir = this->dir();
+
+        dir += getRandomDirection(rng);
+        dir = glm::normalize(dir); // always normalize to only get a small update
+
+        // wall repulsion, if it is enabled (food should not move too close to the wall)
+        if (C::wall) {
+            glm::vec2 nearest_wall = getNearestBorderPoint<C>(pos);
+            // food must be possible to reach by fish
+            if (glm::distance(nearest_wall, pos) <= (float)C::fish_sense_dist) {
+                glm::vec2 wall_repulsion_vector = pos - nearest_wall;
+                wall_repulsion_vector = glm::normalize(wall_repulsion_vector);
+                wall_repulsion_vector *= 2; // make it bit larger to avoid clustering in corners
+                dir = wall_repulsion_vector;
+            }
+        }
+
+        this->setDir(dir);
+        this->setPos(pos + dir);
+    }
+};
+
+
+template<typename C>
+class Fish : public EntityView {
+public:
+    using EntityView::EntityView;
+
+    // create a new fish with random position and direction
+    static Fish spawn(EntityStore& store, int id, RandomStream rng) {
+        glm::vec2 pos = getRandomPlace<C>(rng);
+        glm::vec2 dir = getRandomDirection(rng);
+        return Fish(store, store.add(id, pos, dir));
+    }
+
+    bool alive() const { return store->alive[slot]; }
+
+    // neighbours are slots in this fish's store, close food are slots in `food`
+    // with `mean_field`, the neighbours are only the close ones (for separation and collisions), the count, offsets
+    // and headings of the whole neighbourhood come from the mean field
+    // positions of other entities are always taken as the periodic image nearest to this fish
+    // the new state is written to the same slot of `out`, which is either this fish's store (in-place update),
+    // or the next state buffer (synchronous update)
+    void step(
+        std::span<const int> neighbours,
+        const MeanFieldSums* mean_field,
+        const EntityStore& food,
+        std::span<const int> close_food,
+        const EntityStore& sharks,
+        EntityStore& out,
+        const ModelParams& params,
+        RandomStream rng
+    ) const {
+        // when it is dead, do nothing
+        if (!alive())
+            return;
+
+        // work on local copies of the state, the new state is written back at the end
+        glm::vec2 pos = this->pos();
+        glm::vec2 dir = this->dir();
+        int fear_steps = store->fear_steps[slot];
+
+        // compute average heading, average position and average distance from neighbours
+        // avg heading for alignment, avg pos for cohesion, avg dist for separation
+        // the heading is the sum of unit direction vectors, its direction is the same as the direction given by
+        // the average sin and cos of the heading angles, but it needs no trigonometric functions
+
+        // the sums go over the whole neighbourhood at once, so they can be vectorized (see `neighbourSums`)
+        float half_width = C::wall ? INFINITY : C::width / 2.f;
+        float half_height = C::wall ? INFINITY : C::height / 2.f;
+        NeighbourSums sums = neighbourSums({pos, this->slot, neighbours.data(), (int)neighbours.size(),
+                                            store->pos_x.data(), store->pos_y.data(),
+                                            store->head_x.data(), store->head_y.data(),
+                                            (float)C::width, (float)C::height, half_width, half_height});
+        glm::vec2 heading = sums.heading;
+        float N = (float)neighbours.size();
+        if (mean_field) {
+            heading = mean_field->heading;
+            sums.offset = mean_field->offset;
+            sums.away += mean_field->far_away;
+            N = mean_field->count;
+        }
+
+        // divide everything by N (we want average values)
+        glm::vec2 avg_p = pos + sums.offset / N;
+        glm::vec2 avg_d = sums.away / N;
+
+        // direction of the average heading
+        glm::vec2 avg_heading(1, 0);
+        if (heading.x != 0 || heading.y != 0) {
+            avg_heading = heading * inverseLength(heading);
+        }
+        // add some random noise to the direction angle - rotate by the (tiny) noise angle,
+        // for |noise| <= 0.01 these polynomials match cos and sin to the float precision
+        float noise = rng.uniform(-0.01f, 0.01f);
+        float noise_cos = 1 - noise * noise / 2;
+        float noise_sin = noise - noise * noise * noise / 6;
+        avg_heading = glm::vec2(avg_heading.x * noise_cos - avg_heading.y * noise_sin,
+                                avg_heading.x * noise_sin + avg_heading.y * noise_cos);
+
+        // behaviour depends on if fish has a fear behaviour activated at the moment
+        // momentum - consider previous direction as a base to add the forces
+        if (fear_steps > 0) {
+            dir = dir * params.fish_fear_momentum;
+        } else {
+            dir = dir * params.fish_momentum;
+        }
+
+        // alignment force
+        glm::vec2 allignment_vec = avg_heading;
+        allignment_vec *= params.alignment;
+        dir += allignment_vec;
+
+        // cohesion force
+        glm::vec2 cohesion_vec = avg_p - pos;
+        cohesion_vec *= params.cohesion;
+        dir += cohesion_vec;
+
+        // separation force
+        glm::vec2 separation_vec = avg_d;
+        separation_vec *= params.separation;
+        dir += separation_vec;
+
+        // TODO: food attraction force
+        // for now - go to closest food if there is some close by
+        // (distances are compared squared, so no square roots are needed)
+        glm::vec2 closest_food_pos(0);
+        float closest_food_dist2 = C::fish_sense_dist * C::fish_sense_dist;
+        for (int f : close_food) {
+            glm::vec2 f_pos = pos + sceneOffset<C>(pos, food.pos(f));
+            if (glm::distance2(pos, f_pos) <= closest_food_dist2) {
+                closest_food_pos = f_pos;
+                closest_food_dist2 = glm::distance2(pos, f_pos);
+            }
+        }
+        if (closest_food_dist2 < C::fish_sense_dist * C::fish_sense_dist) { // only use food attraction if some food close by was found
+            glm::vec2 food_attraction_vec = closest_food_pos - pos;
+            food_attraction_vec *= inverseLength(food_attraction_vec); // divide by magnitude
+            food_attraction_vec *= params.food_attraction;
+            dir += food_attraction_vec;
+        }
+
+        // repulse force from each shark
+        bool near_shark = false;
+        for (size_t i = 0; i < sharks.size(); i++) {
+            glm::vec2 shark_pos = pos + sceneOffset<C>(pos, sharks.pos(i));
+            glm::vec2 shark_mouth_position = getMouthFromCenter<C>(shark_pos, sharks.dir(i));
+
+            // add repulsive force from shark if it is near the fish
+            if (glm::distance2(shark_mouth_position, pos) <= (float) (C::fish_sense_dist * C::fish_sense_dist)) {
+                glm::vec2 shark_repulsion_vec = pos - shark_mouth_position;
+                shark_repulsion_vec *= inverseLength(shark_repulsion_vec); // divide by magnitude
+                shark_repulsion_vec *= params.shark_repulsion;
+                dir += shark_repulsion_vec;
+
+                // activate the fear mode
+                fear_steps = C::fish_fear_steps;
+                near_shark = true;
+            }
+        }
+        if (!near_shark && fear_steps != 0) {
+            // decrease the number of steps in fear remaining
+            fear_steps--;
+        }
+
+        // wall repulsion, if it is enabled
+        if (C::wall) {
+            // add wall repulsion vector (from the nearest wall point)
+            glm::vec2 nearest_wall = getNearestBorderPoint<C>(pos);
+            if (glm::distance(nearest_wall, pos) <= (float)C::fish_sense_dist) {
+                glm::vec2 wall_repulsion_vector = pos - nearest_wall;
+                wall_repulsion_vector /= glm::length(wall_repulsion_vector); // divide by its magnitude
+                wall_repulsion_vector *= 2; // make it bit larger to avoid clustering in corners
+                dir += wall_repulsion_vector;
+            }
+
+            // cant go through the wall
+            if (isFishOutOfBorders<C>(pos + dir)) {
+                dir *= -1;
+            }
+        }
+
+        // check if fish does not exceed its max speed
+        if (glm::length(dir) > C::fish_max_speed) {
+            dir /= (glm::length(dir) / C::fish_max_speed);
+        }
+
+        // check if fish dimensions does not overlap with other fish
+        // however, only count this if there is a chance of overlap at all
+        if (dir.x != 0 || dir.y != 0) {
+            resolveCollisions(neighbours, pos, dir);
+        }
+
+        // TODO: adjust the change of direction possible and its momentum (magnitude) - scale direction while turning - if significant turn, there is decrease of momentum
+
+
+        // update fish state (position is moved by the new direction)
+        out.setDir(slot, dir);
+        out.setPos(slot, pos + dir);
+        out.fear_steps[slot] = fear_steps;
+    }
+
+private:
+    static constexpr int COLLISION_BATCH = 16;
+
+    // every overlap with a neighbour reverses (and slows down) the direction of the fish
+    // broad phase: only neighbours in the radius of larger fish dimension (with some margin) can overlap,
+    // these are collected into batches for the overlap kernel; as each reversal flips the frame of this fish,
+    // the kernel gives overlaps for both frames, and they are then taken in the order of neighbours
+    void resolveCollisions(std::span<const int> neighbours, glm::vec2 pos, glm::vec2& dir) const {
+        const glm::vec2 fish_size(C::fish_dim_ellipse_x, C::fish_dim_ellipse_y);
+        const float larger_dim = std::max(C::fish_dim_ellipse_x, C::fish_dim_ellipse_y);
+        const float broad_dist2 = (larger_dim + 5) * (larger_dim + 5);
+        float dx[COLLISION_BATCH], dy[COLLISION_BATCH], hx[COLLISION_BATCH], hy[COLLISION_BATCH];
+        float overlap_pos[COLLISION_BATCH], overlap_neg[COLLISION_BATCH];
+        glm::vec2 frame = dir * inverseLength(dir);
+        bool flipped = false;
+        int count = 0;
+
+        auto flush = [&]() {
+            if (count == 0)
+                return;
+            ellipsesOverlapBatch(fish_size, fish_size, frame, count, dx, dy, hx, hy, overlap_pos, overlap_neg);
+            for (int k = 0; k < count; k++) {
+                if ((flipped ? overlap_neg[k] : overlap_pos[k]) > 0) {
+                    // change the direction
+                    dir *= -0.25; // TODO: FIXME?
+                    flipped = !flipped;
+                }
+            }
+            count = 0;
+        };
+
+        for (int n : neighbours) {
+            glm::vec2 d = sceneOffset<C>(pos, store->pos(n));
+            if (glm::length2(d) > broad_dist2) {
+                continue;
+            }
+            dx[count] = d.x;
+            dy[count] = d.y;
+            hx[count] = store->head_x[n];
+            hy[count] = store->head_y[n];
+            if (++count == COLLISION_BATCH) {
+                flush();
+            }
+        }
+        flush();
+    }
+};
+
+
+template<typename C>
+class Shark : public EntityView {
+public:
+    using EntityView::EntityView;
+
+    // create a new shark with random position and direction
+    static Shark spawn(EntityStore& store, int id, RandomStream rng) {
+        glm::vec2 pos = getRandomPlace<C>(rng);
+        glm::vec2 dir = getRandomDirection(rng);
+        return Shark(store, store.add(id, pos, dir));
+    }
+
+    // visible neighbours are slots in `swarm`
+    void step(const EntityStore& swarm, std::span<const int> visible_neighbours, RandomStream rng) const {
+        glm::vec2 pos = this->pos();
+        glm::vec2 dir = this->dir();
+
+        // compute the average position of neighbouring fish (their periodic images nearest to the shark)
+        int N = 0;
+        auto avg_p = glm::vec2(0.0f);
+        for (int n : visible_neighbours) {
+            avg_p += pos + sceneOffset<C>(pos, swarm.pos(n));
+            N++;
+        }
+
+        // momentum - consider previous direction as a base to add the forces to
+        dir = dir * SHARK_MOMENTUM_CONSTANT;
+
+        if (N == 0) {
+            // if no visible_neighbours, shift randomly for a bit
+            float avg_angle = rng.uniform(-0.5f, 0.5f);
+            auto random_vec = glm::vec2(cos(avg_angle), sin(avg_angle));
+            random_vec *= SHARK_SEARCH_CONSTANT;
+            dir += random_vec;
+        } else {
+            // otherwise go for the average position of neighbouring fish
+            avg_p /= static_cast<float>(N);
+            glm::vec2 hunt_vector = avg_p - pos;
+            hunt_vector /= glm::length2(hunt_vector); // divide by its squared magnitude
+            hunt_vector *= SHARK_HUNT_CONSTANT;
+            dir += hunt_vector;
+        }
+
+        // wall repulsion, if it is enabled
+        if (C::wall) {
+            // add wall repulsion vector
+            glm::vec2 nearest_wall = getNearestBorderPoint<C>(pos);
+            if (glm::distance(nearest_wall, pos) <= (float)C::shark_sense_dist) {
+                glm::vec2 wall_repulsion_vec = pos - nearest_wall;
+                wall_repulsion_vec /= glm::length(wall_repulsion_vec); // divide by its magnitude
+                wall_repulsion_vec *= 2;
+                dir += wall_repulsion_vec;
+            }
+
+            // cant go trough wall
+            if (isFishOutOfBorders<C>(pos + dir)) {
+                dir *= -1;
+            }
+        }
+
+        // ensure max speed of a shark
+        if (glm::length(dir) > C::shark_max_speed) {
+            dir /= (glm::length(dir) / C::shark_max_speed);
+        }
+
+        // update position
+        this->setDir(dir);
+        this->setPos(pos + dir);
+    }
+};
+
+
+// streaming json encoder, every value goes to the stream as soon as it is written (no document is built)
+// so the memory of the log does not grow with the number of steps
+// keys are plain identifiers, they are not escaped
+class JsonWriter {
+public:
+    explicit JsonWriter(std::ostream& out) : out(out) {}
+
+    void beginObject() { separate(); out.put('{'); first = true; }
+    void endObject() { out.put('}'); first = false; }
+    void beginArray() { separate(); out.put('['); first = true; }
+    void endArray() { out.put(']'); first = false; }
+
+    void key(const char* name) {
+        separate();
+        out.put('"');
+        out << name;
+        out.write("\":", 2);
+        first = true;  // the value follows without a separator
+    }
+
+    void value(bool v) { separate(); v ? out.write("true", 4) : out.write("false", 5); }
+    void value(int v) { number(v); }
+    void value(size_t v) { number(v); }
+
+    // shortest representation that reads back as the same double, non-finite numbers are null
+    void value(double v) {
+        separate();
+        if (!std::isfinite(v)) {
+            out.write("null", 4);
+            return;
+        }
+        char buffer[32];
+        char* end = std::to_chars(buffer, buffer + sizeof(buffer), v).ptr;
+        out.write(buffer, end - buffer);
+        // keep whole numbers floating-point (as the former nlohmann log did)
+        if (std::find_if(buffer, end, [](char c) { return c == '.' || c == 'e'; }) == end)
+            out.write(".0", 2);
+    }
+
+    template<typename T>
+    void field(const char* name, T v) {
+        key(name);
+        value(v);
+    }
+
+private:
+    template<typename T>
+    void number(T v) {
+        separate();
+        char buffer[24];
+        char* end = std::to_chars(buffer, buffer + sizeof(buffer), v).ptr;
+        out.write(buffer, end - buffer);
+    }
+
+    void separate() {
+        if (!first)
+            out.put(',');
+        first = false;
+    }
+
+    std::ostream& out;
+    bool first = true;  // nothing written at the current level yet
+};
+
+// copy of the logged fields of an entity group, the vectors keep their capacity when a snapshot is reused
+struct GroupSnapshot {
+    vector<float> pos_x, pos_y;
+    vector<float> dir_x, dir_y;
+    vector<int> id;
+    vector<unsigned char> alive;
+
+    size_t size() const { return id.size(); }
+
+    void copyFrom(const EntityStore& store) {
+        pos_x.assign(store.pos_x.begin(), store.pos_x.end());
+        pos_y.assign(store.pos_y.begin(), store.pos_y.end());
+        dir_x.assign(store.dir_x.begin(), store.dir_x.end());
+        dir_y.assign(store.dir_y.begin(), store.dir_y.end());
+        id.assign(store.id.begin(), store.id.end());
+        alive.assign(store.alive.begin(), store.alive.end());
+    }
+
+    // copy of the entities in slots order[0], order[1], ...
+    void copyFrom(const EntityStore& store, std::span<const int> order) {
+        auto field = [&](auto& to, const auto& values) {
+            to.resize(order.size());
+            for (size_t k = 0; k < order.size(); k++)
+                to[k] = values[order[k]];
+        };
+        field(pos_x, store.pos_x);
+        field(pos_y, store.pos_y);
+        field(dir_x, store.dir_x);
+        field(dir_y, store.dir_y);
+        field(id, store.id);
+        field(alive, store.alive);
+    }
+};
+
+// state of one step handed over from the simulation to the log thread
+struct StateSnapshot {
+    int step = 0;
+    GroupSnapshot swarm, sharks, food;
+    vector<unsigned char> fish_logged;   // filled by the log thread if only some fish are logged, else empty
+    uint32_t dead_fish = 0;
+    uint32_t eaten_food = 0;             // since the previous logged step
+    uint32_t eaten_fish = 0;             // since the previous logged step
+
+    TrajectoryFrame frame() const {
+        return {swarm.pos_x, swarm.pos_y, swarm.dir_x, swarm.dir_y, swarm.alive, fish_logged,
+                sharks.pos_x, sharks.pos_y, sharks.dir_x, sharks.dir_y,
+                food.pos_x, food.pos_y,
+                dead_fish, eaten_food};
+    }
+};
+
+// bounded single-producer single-consumer queue of reusable slots, lock-free
+// the producer fills the slot from acquire() and publishes it, the consumer reads front() and releases it
+// either side only waits (std::atomic::wait) when the queue is full or empty
+template<typename T>
+class SpscQueue {
+public:
+    explicit SpscQueue(size_t capacity) : slots(std::max<size_t>(1, capacity)), end_marks(slots.size(), 0) {}
+
+    // free slot for the next item, waits while the queue is full
+    T& acquire() {
+        uint64_t h = head.load(std::memory_order_relaxed);
+        for (uint64_t t = tail.load(std::memory_order_acquire); h - t == slots.size();
+             t = tail.load(std::memory_order_acquire)) {
+            tail.wait(t, std::memory_order_acquire);
+        }
+        end_marks[h % slots.size()] = 0;
+        return slots[h % slots.size()];
+    }
+
+    void publish() {
+        head.fetch_add(1, std::memory_order_release);
+        head.notify_one();
+    }
+
+    // no more items, the consumer gets nullptr after the queued ones
+    void close() {
+        acquire();
+        end_marks[head.load(std::memory_order_relaxed) % slots.size()] = 1;
+        publish();
+    }
+
+    // oldest item, waits while the queue is empty, nullptr once the queue is closed
+    T* front() {
+        uint64_t t = tail.load(std::memory_order_relaxed);
+        for (uint64_t h = head.load(std::memory_order_acquire); h == t; h = head.load(std::memory_order_acquire))
+            head.wait(h, std::memory_order_acquire);
+        return end_marks[t % slots.size()] ? nullptr : &slots[t % slots.size()];
+    }
+
+    void release() {
+        tail.fetch_add(1, std::memory_order_release);
+        tail.notify_one();
+    }
+
+private:
+    vector<T> slots;
+    vector<char> end_marks;       // the slot closes the queue
+    std::atomic<uint64_t> head{0}; // items published by the producer
+    std::atomic<uint64_t> tail{0}; // items released by the consumer
+};
+
+// totals of one whole simulation
+struct SimulationResult {
+    size_t fish_eaten = 0;
+    size_t food_eaten = 0;
+};
+
+// the fixed parameters are given by the configuration `C` (`StaticConfig` or `RuntimeConfig`)
+template<typename C>
+class Scene {
+private:
+
+    using Fish_t = Fish<C>;
+    using Shark_t = Shark<C>;
+    using Food_t = Food<C>;
+
+    ModelParams params;
+    uint64_t seed;
+
+    // all the state is kept in per-field arrays, Fish_t/Shark_t/Food_t are views into them
+    EntityStore swarm;
+    EntityStore sharks;
+    EntityStore food;  // fixed number of slots, eaten food is replaced in its slot by a new piece
+    int next_food_index; // when inserting new food, use this free (not used) index
+    int current_step = 0; // index of the step being simulated, it keys the random numbers
+
+    // random stream for given entity and purpose in the current step
+    RandomStream random(int entity_id, RandomPurpose purpose) const {
+        return RandomStream(seed, (uint32_t)current_step, (uint32_t)entity_id, purpose);
+    }
+
+    // spatial indices of alive fish and food, rebuilt once per step
+    // entities that move during the step (fish update in place) are re-linked right after their update
+    // fish are in the grid or in the quadtree (SPATIAL_INDEX, "auto" decides every step by `fishCrowding`)
+    SpatialGrid fish_grid;
+    QuadTree fish_tree;
+    bool fish_tree_used = false;
+    int fish_tree_builds = 0;
+    vector<int> cell_counts;
+    MeanFieldGrid fish_field;   // aggregates of the fish if MEAN_FIELD > 0
+    SpatialGrid food_grid;
+
+    // slot of every fish id in `swarm`, the slots change when the fish are sorted (SORT_EVERY), the ids do not
+    // everything whose result depends on the order of fish (the in-place update, eating, the grid) goes in the
+    // order of ids, so sorting does not change the simulation
+    vector<int> fish_slot;
+    vector<int> sort_order;
+    vector<uint32_t> sort_keys;
+    EntityStore swarm_sorted;
+
+    // neighbour candidates of fish if VERLET_SKIN > 0, rebuilt only when a fish moved through the skin
+    // while not valid (a fish moved too far during the in-place update), the neighbours come from the grid
+    VerletLists fish_lists;
+    bool fish_lists_valid = false;
+    int fish_list_builds = 0;
+
+    // next state of fish for the synchronous update
+    EntityStore swarm_next;
+
+    // storage for query results, one arena per thread, reset at the start of every step
+    vector<ScratchArena<int>> scratch;
+
+    // mean number of fish in the grid cell of a fish (sum of the squared cell counts per fish), a few for fish
+    // spread over the scene, tens or more when the school is packed into dense blobs
+    float fishCrowding() {
+        cell_counts.assign(fish_grid.cols * fish_grid.rows, 0);
+        size_t alive = 0;
+        size_t sum_squares = 0;
+        for (size_t i = 0; i < swarm.size(); i++) {
+            if (!swarm.alive[i])
+                continue;
+            glm::ivec2 cell = fish_grid.cellOf(swarm.pos(i));
+            int& count = cell_counts[cell.y * fish_grid.cols + cell.x];
+            sum_squares += 2 * count + 1;   // (n + 1)^2 - n^2
+            count++;
+            alive++;
+        }
+        return alive > 0 ? (float)sum_squares / alive : 0;
+    }
+
+    void rebuildFishIndex() {
+        if (SPATIAL_INDEX == "auto") {
+            // the quadtree is dropped only well below the threshold, so the index does not flip every step
+            float crowding = fishCrowding();
+            fish_tree_used = fish_tree_used ? crowding > QUADTREE_CROWDING / 2 : crowding > QUADTREE_CROWDING;
+        } else {
+            fish_tree_used = SPATIAL_INDEX == "quadtree";
+        }
+
+        if (fish_tree_used) {
+            fish_tree.build(swarm, SYNC_UPDATE);
+            fish_tree_builds++;
+            return;
+        }
+        fish_grid.clear(swarm.size());
+        for (int fi : fish_slot) {
+            if (swarm.alive[fi])
+                fish_grid.insert(fi, swarm.pos(fi));
+        }
+    }
+
+    template<typename F>
+    void forEachFishCandidate(glm::vec2 pos, float radius, F f) const {
+        if (fish_tree_used)
+            fish_tree.forEachCandidate(pos, radius, f);
+        else
+            fish_grid.forEachCandidate(pos, radius, f);
+    }
+
+    void removeFromFishIndex(int fish) {
+        if (fish_tree_used)
+            fish_tree.remove(fish);
+        else
+            fish_grid.remove(fish);
+    }
+
+    void moveInFishIndex(int fish, glm::vec2 pos) {
+        if (fish_tree_used)
+            fish_tree.move(fish, pos);
+        else
+            fish_grid.move(fish, pos);
+    }
+
+    // reorder the fish slots by the Morton code of their grid cell (dead fish last), so that fish close in the scene
+    // are mostly close in memory and the neighbour loops stream through it
+    // the storage of `swarm` stays in place (the Python module exposes it)
+    void sortFish() {
+        sort_order.resize(swarm.size());
+        sort_keys.resize(swarm.size());
+        for (size_t i = 0; i < swarm.size(); i++) {
+            glm::ivec2 cell = fish_grid.cellOf(swarm.pos(i));
+            sort_order[i] = (int)i;
+            sort_keys[i] = swarm.alive[i] ? mortonCode(cell.x, cell.y) : UINT32_MAX;
+        }
+        std::sort(sort_order.begin(), sort_order.end(), [&](int a, int b) {
+            return sort_keys[a] != sort_keys[b] ? sort_keys[a] < sort_keys[b] : swarm.id[a] < swarm.id[b];
+        });
+        swarm_sorted.gather(swarm, sort_order);
+        swarm = swarm_sorted;
+        for (size_t i = 0; i < swarm.size(); i++)
+            fish_slot[swarm.id[i]] = (int)i;
+
+        // the lists refer to the old slots
+        fish_lists.reorder(sort_order);
+    }
+
+    void rebuildGrids() {
+        rebuildFishIndex();
+        if (MEAN_FIELD > 0)
+            fish_field.build(swarm, fish_slot);   // in the order of ids, like the grid
+        food_grid.clear(food.size());
+        for (size_t i = 0; i < food.size(); i++) {
+            if (food.alive[i])
+                food_grid.insert((int)i, food.pos(i));
+        }
+    }
+
+    // rebuild the Verlet lists of fish if a fish moved more than skin / 2 since the build
+    void updateFishLists() {
+        if (fish_lists.empty() || 2 * fish_lists.maxDisplacement<C>(swarm) > VERLET_SKIN) {
+            fish_lists.build<C>(swarm, (float)C::fish_sense_dist + VERLET_SKIN, fish_slot);
+            fish_list_builds++;
+        }
+        fish_lists_valid = true;
+    }
+
+public:
+    Scene(const ModelParams& params, uint64_t seed)
+        : params(params), seed(seed),
+          // with the mean field, the fish grid mostly answers the close-range queries
+          fish_grid(C::width, C::height, MEAN_FIELD > 0 ? (int)std::ceil(MEAN_FIELD_CLOSE) : C::fish_sense_dist, !C::wall),
+          fish_tree(C::width, C::height, !C::wall),
+          fish_field(C::width, C::height, (float)C::fish_sense_dist / std::max(MEAN_FIELD, 1), !C::wall),
+          food_grid(C::width, C::height, C::fish_sense_dist, !C::wall) {
+        // generate fish
+        for (int i=0; i < NUM_FISH; i ++) {
+            Fish_t::spawn(swarm, i, random(i, RandomPurpose::FishSpawn));
+        }
+
+        // generate sharks
+        for (int i = 0; i < NUM_SHARKS; i++) {
+            Shark_t::spawn(sharks, i, random(i, RandomPurpose::SharkSpawn));
+        }
+
+        // generate food
+        for (int i = 0; i < NUM_FOOD; i++) {
+            Food_t::spawn(food, i, random(i, RandomPurpose::FoodSpawn));
+        }
+        next_food_index = NUM_FOOD;
+
+        // fish ids are 0 .. NUM_FISH - 1
+        for (int i = 0; i < NUM_FISH; i++)
+            fish_slot.push_back(i);
+
+        scratch.resize(maxThreads());
+    }
+
+    // current state, the storage of the stores stays in place for the whole life of the scene
+    const EntityStore& getSwarm() const { return swarm; }
+    const EntityStore& getSharks() const { return sharks; }
+    const EntityStore& getFood() const { return food; }
+
+    // shortest displacement between two points of the scene (over the border if the scene wraps)
+    glm::vec2 offset(glm::vec2 from, glm::vec2 to) const {
+        return sceneOffset<C>(from, to);
+    }
+
+    // get neighbors (slots in swarm) for prey fish up to certain distance
+    // like all the queries below, the result lives in the given scratch arena until the end of the step
+    // the candidates come from the Verlet lists if they are enabled, else from the grid
+    // (`radius` is smaller than the sense distance only for the close neighbours of the mean field)
+    std::span<const int> getFishNeighbours(int fish, ScratchArena<int>& arena, float radius = (float)C::fish_sense_dist) {
+        if (FISH_NEIGHBOURS > 0)
+            return getNearestFish(fish, arena);
+        glm::vec2 pos = swarm.pos(fish);
+        auto check = [&](int i) {
+            if (glm::length2(offset(pos, swarm.pos(i))) <= radius * radius) {
+                arena.push(i);
+            }
+        };
+
+        arena.begin();
+        if (VERLET_SKIN > 0 && fish_lists_valid) {
+            for (int i : fish_lists.candidates(fish)) {
+                if (swarm.alive[i])
+                    check(i);
+            }
+        } else {
+            forEachFishCandidate(pos, radius, check);
+        }
+
+        return arena.end();
+    }
+
+    // topological neighbourhood: the fish itself and its FISH_NEIGHBOURS nearest neighbours within the sense distance,
+    // from the nearest (ties by id), so the neighbours and their order do not depend on the index or the slots
+    // the index skips the cells (nodes) farther than the farthest neighbour found so far
+    std::span<const int> getNearestFish(int fish, ScratchArena<int>& arena) {
+        glm::vec2 pos = swarm.pos(fish);
+        NearestNeighbours<MAX_FISH_NEIGHBOURS> nearest;
+        nearest.reset(FISH_NEIGHBOURS, (float)C::fish_sense_dist);
+        auto offer = [&](int i) {
+            if (i != fish)
+                nearest.offer(glm::length2(offset(pos, swarm.pos(i))), swarm.id[i], i);
+            return nearest.bound();
+        };
+
+        if (VERLET_SKIN > 0 && fish_lists_valid) {
+            for (int i : fish_lists.candidates(fish)) {
+                if (swarm.alive[i])
+                    offer(i);
+            }
+        } else if (fish_tree_used) {
+            fish_tree.forEachCandidateNearFirst(pos, (float)C::fish_sense_dist, offer);
+        } else {
+            fish_grid.forEachCandidateNearFirst(pos, (float)C::fish_sense_dist, offer);
+        }
+
+        arena.begin();
+        arena.push(fish);
+        nearest.forEachNearest([&](int i) { arena.push(i); });
+        return arena.end();
+    }
+
+    // get food (slots in food) for prey fish which is up to certain distance
+    std::span<const int> getNeighbouringFood(int fish, ScratchArena<int>& arena) {
+        glm::vec2 pos = swarm.pos(fish);
+
+        arena.begin();
+        food_grid.forEachCandidate(pos, (float)C::fish_sense_dist, [&](int i) {
+            if (glm::length2(offset(pos, food.pos(i))) <= (float)(C::fish_sense_dist * C::fish_sense_dist)) {
+                arena.push(i);
+            }
+        });
+
+        return arena.end();
+    }
+
+    bool isInBlindSpot(glm::vec2 fishPos, glm::vec2 sharkPos, glm::vec2 sharkDir) {
+        // Calculate the vector from the shark to the fish
+        glm::vec2 sharkToFish = fishPos - sharkPos;
+
+        // Calculate the angle between the shark's direction and the vector from the shark to the fish
+        float angle = glm::angle(sharkDir, sharkToFish);
+
+        // Convert the blind spot angle from degrees to radians
+        float blindSpotAngleRad = glm::radians((float)C::shark_blind_angle_deg);
+
+        // If the angle is greater than or equal to the blind spot angle, the fish is in the blind spot
+        return angle >= glm::pi<float>() - blindSpotAngleRad / 2;
+    }
+
+    // get neighbors for predator shark up to certain distance (over the border if the scene wraps)
+    std::span<const int> getFishPrey(int shark, ScratchArena<int>& arena) {
+        glm::vec2 pos = sharks.pos(shark);
+        glm::vec2 dir = sharks.dir(shark);
+
+        arena.begin();
+        forEachFishCandidate(pos, (float)C::shark_sense_dist, [&](int i) {
+            glm::vec2 image = pos + offset(pos, swarm.pos(i));
+            if (glm::distance2(pos, image) <= (float)(C::shark_sense_dist * C::shark_sense_dist) &&
+                !isInBlindSpot(image, pos, dir)) {
+                    arena.push(i);
+            }
+        });
+
+        return arena.end();
+    }
+
+    // mark eaten fish as dead and return them
+    std::span<const int> getEatenFish(int shark, ScratchArena<int>& arena) {
+        glm::vec2 mouth = getMouthFromCenter<C>(sharks.pos(shark), sharks.dir(shark));
+
+        arena.begin();
+        forEachFishCandidate(mouth, (float)C::shark_kill_radius, [&](int i) {
+            if (glm::length2(offset(mouth, swarm.pos(i))) <= (float)(C::shark_kill_radius * C::shark_kill_radius)) {
+                arena.push(i);
+            }
+        });
+        std::span<const int> eatenFish = arena.end();
+
+        // unlink dead fish only after the traversal, so that the cell lists stay intact
+        for (int i : eatenFish) {
+            swarm.alive[i] = 0;
+            removeFromFishIndex(i);
+        }
+        return eatenFish;
+    }
+
+    // mark eaten food pieces and return their slots
+    std::span<const int> getEatenFood(int fish, ScratchArena<int>& arena) {
+        glm::vec2 pos = swarm.pos(fish);
+
+        arena.begin();
+        food_grid.forEachCandidate(pos, (float)C::fish_dim_ellipse_x, [&](int i) {
+            if (glm::length2(offset(pos, food.pos(i))) <= (float)(C::fish_dim_ellipse_x * C::fish_dim_ellipse_x)) {
+                food.alive[i] = 0;
+                arena.push(i);
+            }
+        });
+        return arena.end();
+    }
+
+    // Function to wrap outer boundaries of the canvas using "cyclic" boundaries
+    // gets a point, returns either same point, or point on opposite side if it "crosses" boundary
+    void wrap(float& x, float& y) {
+        if (x < 0) x += C::width;
+        if (y < 0) y += C::height;
+        if (x >= C::width) x -= C::width;
+        if (y >= C::height) y -= C::height;
+    }
+
+    // remove and count food eaten by the fish, add new food into the freed slots
+    size_t eatFood(int fish, ScratchArena<int>& arena) {
+        std::span<const int> eaten_food = getEatenFood(fish, arena);
+        for (int slot : eaten_food) {
+            food_grid.remove(slot);
+            Food_t::spawn(food, next_food_index, random(next_food_index, RandomPurpose::FoodSpawn), slot);
+            food_grid.insert(slot, food.pos(slot));
+            next_food_index++;
+        }
+        return eaten_food.size();
+    }
+
+    // new state of an alive fish into the same slot of `out`, from its exact neighbourhood, or from the mean field
+    // and its close neighbours if MEAN_FIELD > 0
+    void stepFish(int fi, EntityStore& out, ScratchArena<int>& arena) {
+        std::span<const int> food_close_by = getNeighbouringFood(fi, arena);
+        RandomStream rng = random(swarm.id[fi], RandomPurpose::FishNoise);
+        if (MEAN_FIELD > 0) {
+            MeanFieldSums field = fish_field.sums(swarm.pos(fi), (float)C::fish_sense_dist, MEAN_FIELD_CLOSE);
+            std::span<const int> close = getFishNeighbours(fi, arena, MEAN_FIELD_CLOSE);
+            Fish_t(swarm, fi).step(close, &field, food, food_close_by, sharks, out, params, rng);
+        } else {
+            std::span<const int> neighbours = getFishNeighbours(fi, arena);
+            Fish_t(swarm, fi).step(neighbours, nullptr, food, food_close_by, sharks, out, params, rng);
+        }
+    }
+
+    // fish are moved one after another, each one already sees the new positions of the fish before it
+    size_t stepFishInPlace() {
+        size_t eaten_food_counter = 0;
+        for (int fi : fish_slot) {
+            Fish_t f(swarm, fi);
+            if (f.alive()) {
+                glm::vec2 old_pos = f.pos();
+                glm::vec2 old_head(swarm.head_x[fi], swarm.head_y[fi]);
+                stepFish(fi, swarm, scratch[0]);
+                wrap(swarm.pos_x[fi], swarm.pos_y[fi]);
+                moveInFishIndex(fi, f.pos());
+                if (MEAN_FIELD > 0)
+                    fish_field.move(old_pos, old_head, f.pos(), {swarm.head_x[fi], swarm.head_y[fi]});
+
+                // the fish after it see its new position, the lists hold only while it is within skin / 2
+                if (fish_lists_valid && 2 * fish_lists.displacement<C>(fi, swarm) > VERLET_SKIN)
+                    fish_lists_valid = false;
+            }
+
+            // (as before, food drifting onto a dead fish is counted as eaten too)
+            eaten_food_counter += eatFood(fi, scratch[0]);
+        }
+        return eaten_food_counter;
+    }
+
+    // all fish are moved from the state of the previous step into `swarm_next` in parallel,
+    // the food is then eaten in the order of fish, so the result does not depend on the number of threads
+    size_t stepFishSynchronous() {
+        swarm_next = swarm;
+
+#ifdef _OPENMP
+        #pragma omp parallel for schedule(dynamic, 64)
+#endif
+        for (int fi = 0; fi < (int)swarm.size(); fi++) {
+            if (!swarm.alive[fi])
+                continue;
+            stepFish(fi, swarm_next, scratch[threadIndex()]);
+            wrap(swarm_next.pos_x[fi], swarm_next.pos_y[fi]);
+        }
+        // copied rather than swapped, so the storage of `swarm` never moves (the Python module exposes it)
+        swarm = swarm_next;
+
+        // the grid has to match the new positions for eating and for the sharks
+        rebuildFishIndex();
+
+        size_t eaten_food_counter = 0;
+        for (int fi : fish_slot) {
+            eaten_food_counter += eatFood(fi, scratch[0]);
+        }
+        return eaten_food_counter;
+    }
+
+    // sharks move one after another, each one eats right after its move
+    size_t stepSharksInPlace() {
+        size_t eaten_fish_counter = 0;
+        for (int si = 0; si < (int)sharks.size(); si++) {
+            // move shark
+            std::span<const int> prey_neighbours = getFishPrey(si, scratch[0]);
+            Shark_t(sharks, si).step(swarm, prey_neighbours, random(sharks.id[si], RandomPurpose::SharkSearch));
+            wrap(sharks.pos_x[si], sharks.pos_y[si]);
+
+            // label and count eaten fish
+            std::span<const int> eaten_fish = getEatenFish(si, scratch[0]);
+            eaten_fish_counter += eaten_fish.size();
+        }
+        return eaten_fish_counter;
+    }
+
+    // all sharks move in parallel (they do not see each other), then eat in their order
+    size_t stepSharksSynchronous() {
+#ifdef _OPENMP
+        #pragma omp parallel for
+#endif
+        for (int si = 0; si < (int)sharks.size(); si++) {
+            std::span<const int> prey_neighbours = getFishPrey(si, scratch[threadIndex()]);
+            Shark_t(sharks, si).step(swarm, prey_neighbours, random(sharks.id[si], RandomPurpose::SharkSearch));
+            wrap(sharks.pos_x[si], sharks.pos_y[si]);
+        }
+
+        size_t eaten_fish_counter = 0;
+        for (int si = 0; si < (int)sharks.size(); si++) {
+            eaten_fish_counter += getEatenFish(si, scratch[0]).size();
+        }
+        return eaten_fish_counter;
+    }
+
+    // numbers of fish and food eaten in one step
+    struct StepCounts {
+        size_t fish_eaten = 0;
+        size_t food_eaten = 0;
+    };
+
+    // simulate one step of the whole scene
+    StepCounts advance() {
+        // food drifting (every piece on its own, so it can run in parallel)
+#ifdef _OPENMP
+        #pragma omp parallel for if(SYNC_UPDATE)
+#endif
+        for (int fi = 0; fi < (int)food.size(); fi++) {
+            Food_t(food, fi).step(random(food.id[fi], RandomPurpose::FoodDrift));
+            wrap(food.pos_x[fi], food.pos_y[fi]);
+        }
+
+        if (SORT_EVERY > 0 && current_step % SORT_EVERY == 0)
+            sortFish();
+        rebuildGrids();
+        if (VERLET_SKIN > 0)
+            updateFishLists();
+        for (auto& arena : scratch)
+            arena.reset();
+
+        // move fish, then sharks
+        StepCounts counts;
+        counts.food_eaten = SYNC_UPDATE ? stepFishSynchronous() : stepFishInPlace();
+        counts.fish_eaten = SYNC_UPDATE ? stepSharksSynchronous() : stepSharksInPlace();
+
+        current_step++;
+        return counts;
+    }
+
+    // differences between the new fish directions computed by two variants of the fish update
+    struct UpdateDeviation {
+        float max = 0;
+        double sum = 0;     // over `count` fish
+        size_t count = 0;
+        size_t close_neighbours = 0;    // mean field: other fish within the close distance, over `count` fish
+    };
+
+    // differences between the new fish directions computed by two variants of the fish update, both computed from
+    // the current state (the scene itself does not change)
+    // `use_variant(false)` switches to the reference update, `use_variant(true)` to the compared one
+    template<typename F>
+    UpdateDeviation fishUpdateDeviation(F use_variant) {
+        EntityStore reference = swarm;
+        EntityStore variant = swarm;
+        UpdateDeviation deviation;
+
+        rebuildGrids();
+        if (VERLET_SKIN > 0)
+            updateFishLists();
+        for (int fi = 0; fi < (int)swarm.size(); fi++) {
+            if (!swarm.alive[fi])
+                continue;
+            scratch[0].reset();
+            use_variant(false);
+            stepFish(fi, reference, scratch[0]);
+            use_variant(true);
+            stepFish(fi, variant, scratch[0]);
+            float distance = glm::distance(reference.dir(fi), variant.dir(fi));
+            if (std::isnan(distance))
+                continue;   // a fish with a NaN position (spawned on top of another one) in both variants
+            deviation.max = std::max(deviation.max, distance);
+            deviation.sum += distance;
+            deviation.count++;
+        }
+        return deviation;
+    }
+
+    // fast-math against the exact fish update
+    UpdateDeviation fastMathDeviation() {
+        bool fast_math = FAST_MATH;
+        UpdateDeviation deviation = fishUpdateDeviation([](bool fast) { FAST_MATH = fast; });
+        FAST_MATH = fast_math;
+        return deviation;
+    }
+
+    // mean field against the exact neighbourhood (the aggregates are built by fishUpdateDeviation), with the close
+    // neighbours its separation and collisions were computed from
+    UpdateDeviation meanFieldDeviation() {
+        int resolution = MEAN_FIELD;
+        UpdateDeviation deviation = fishUpdateDeviation([resolution](bool mean_field) { MEAN_FIELD = mean_field ? resolution : 0; });
+        MEAN_FIELD = resolution;
+        for (int fi = 0; fi < (int)swarm.size(); fi++) {
+            if (!swarm.alive[fi] || std::isnan(swarm.pos_x[fi]))
+                continue;
+            scratch[0].reset();
+            deviation.close_neighbours += getFishNeighbours(fi, scratch[0], MEAN_FIELD_CLOSE).size() - 1;  // not itself
+        }
+        return deviation;
+    }
+
+    // selected neighbourhood sums kernel against the scalar one
+    float simdDeviation() {
+        NeighbourSumsKernel kernel = neighbourSums;
+        float deviation = fishUpdateDeviation([kernel](bool selected) {
+            neighbourSums = selected ? kernel : neighbourSumsScalar;
+        }).max;
+        neighbourSums = kernel;
+        return deviation;
+    }
+
+    // simulate all the steps without any output
+    SimulationResult run() {
+        SimulationResult result;
+        for (int i = 0; i < NUM_STEPS; i++) {
+            StepCounts counts = advance();
+            result.fish_eaten += counts.fish_eaten;
+            result.food_eaten += counts.food_eaten;
+        }
+        return result;
+    }
+
+    // one log file, written step by step by the log thread: the log of the whole run, or a flight recorder clip
+    // `header` describes the file (also the numbering of the steps of the json log)
+    class LogFile {
+    public:
+        LogFile(const string& filepath, const TrajectoryHeader& header) : json(file), header(header) {
+            file.rdbuf()->pubsetbuf(buffer.data(), (std::streamsize)buffer.size());
+            file.open(filepath, std::ofstream::out | std::ofstream::trunc | std::ofstream::binary);
+            if (LOG_FORMAT == "binary")
+                trajectory.emplace(file, header);
+            else
+                beginJsonLog(json, header);
+        }
+
+        void write(const StateSnapshot& step) {
+            if (trajectory)
+                trajectory->write(step.frame());
+            else
+                logStep(json, step);
+        }
+
+        void finish() {
+            if (trajectory) {
+                trajectory->finish();
+            } else {
+                json.endArray();
+                json.field("stepsTotal", (int)header.steps);
+                json.field("wall", (bool)C::wall);
+                json.endObject();
+            }
+            file.close();
+        }
+
+    private:
+        vector<char> buffer = vector<char>(1 << 20);
+        std::ofstream file;
+        JsonWriter json;
+        TrajectoryHeader header;
+        std::optional<TrajectoryWriter> trajectory;
+    };
+
+    // flight recorder (RECORD_BEFORE > 0): keeps the last RECORD_BEFORE logged steps in a ring, a kill writes
+    // them, its own step and the next RECORD_AFTER logged steps to a clip (see `clipFilepath`), so long runs
+    // write only the steps around the kills, with bounded memory
+    // runs on the log thread, the snapshots are swapped into the ring rather than copied
+    class FlightRecorder {
+    public:
+        FlightRecorder(const string& log_filepath, const TrajectoryHeader& header)
+            : log_filepath(log_filepath), header(header), ring(RECORD_BEFORE) {}
+
+        // the snapshot gets the storage of the oldest step of the ring back
+        void record(StateSnapshot& step) {
+            bool kill = step.eaten_fish > 0;
+            if (!clip && kill)
+                openClip(step.step);
+            if (!clip) {
+                std::swap(ring[(oldest + count) % ring.size()], step);
+                if (count < ring.size())
+                    count++;
+                else
+                    oldest = (oldest + 1) % ring.size();
+                return;
+            }
+
+            clip->write(step);
+            if (kill)
+                remaining = RECORD_AFTER;
+            else
+                remaining--;
+            if (remaining <= 0) {
+                clip->finish();
+                clip.reset();
+            }
+        }
+
+        // the clip of a kill in the last steps ends with them
+        void finish() {
+            if (clip)
+                clip->finish();
+        }
+
+    private:
+        string log_filepath;   // the clips are written next to it
+        TrajectoryHeader header;
+        vector<StateSnapshot> ring;
+        size_t oldest = 0;   // ring slot of the oldest recorded step
+        size_t count = 0;    // recorded steps in the ring
+        std::optional<LogFile> clip;
+        int remaining = 0;   // logged steps still written to the clip
+
+        // starts a clip with the steps of the ring, they are not recorded for the next clip again
+        void openClip(int kill_step) {
+            TrajectoryHeader clip_header = header;
+            clip_header.flags |= TRAJECTORY_CLIP;
+            clip_header.event_step = kill_step;
+            clip_header.first_step = count > 0 ? ring[oldest].step : kill_step;
+            clip.emplace(clipFilepath(log_filepath, kill_step), clip_header);
+            for (size_t k = 0; k < count; k++)
+                clip->write(ring[(oldest + k) % ring.size()]);
+            oldest = 0;
+            count = 0;
+        }
+    };
+
+    // simulate all the steps, the log for visualization is streamed to `output_filepath` step by step
+    // the log is encoded and written by its own thread, the simulation only copies the state of every logged
+    // step (see `isLoggedStep`) into a queue of snapshots (and waits only if the log thread falls
+    // `LOG_QUEUE_SIZE` steps behind), the log thread also selects the logged fish
+    // with the flight recorder (RECORD_BEFORE > 0) only the clips around kills are written
+    void simulate(const string& output_filepath) {
+        size_t fish_eaten_total = 0;
+        size_t food_eaten_total = 0;
+        size_t food_eaten_since_logged = 0;
+        size_t fish_eaten_since_logged = 0;
+
+        std::optional<LogFile> log;
+        std::optional<FlightRecorder> recorder;
+        SpscQueue<StateSnapshot> snapshots(LOG_QUEUE_SIZE);
+        std::thread log_thread;
+        if (debug) {
+            if (RECORD_BEFORE > 0)
+                recorder.emplace(output_filepath, trajectoryHeader());
+            else
+                log.emplace(output_filepath, trajectoryHeader());
+
+            log_thread = std::thread([&]() {
+                while (StateSnapshot* snapshot = snapshots.front()) {
+                    if (isFishSubsetLogged())
+                        selectLoggedFish(*snapshot);
+                    if (recorder)
+                        recorder->record(*snapshot);
+                    else
+                        log->write(*snapshot);
+                    snapshots.release();
+                }
+            });
+        }
+
+        for (int i = 0; i < NUM_STEPS; i++){
+            if (debug) std::cout << "step #" << i;
+
+            StepCounts counts = advance();
+            size_t eaten_food_counter = counts.food_eaten;
+            size_t eaten_fish_counter = counts.fish_eaten;
+
+            // progress lines are not flushed one by one
+            if (eaten_fish_counter > 0) {
+                if (debug) std::cout << " [" << eaten_fish_counter << " fish eaten]";
+                if (eaten_food_counter > 0) {
+                    if (debug) std::cout << " [" << eaten_food_counter << " food eaten]" << '\n';
+                    food_eaten_total += eaten_food_counter;
+                } else {
+                    if (debug) std::cout << '\n';
+                }
+                fish_eaten_total += eaten_fish_counter;
+            } else if (eaten_food_counter > 0) {
+                if (debug) std::cout << "               " << " [" << eaten_food_counter << " food eaten]" << '\n';
+                food_eaten_total += eaten_food_counter;
+            } else {
+                if (debug) std::cout << '\n';
+            }
+            food_eaten_since_logged += eaten_food_counter;
+            fish_eaten_since_logged += eaten_fish_counter;
+            if (debug && isLoggedStep(i)) {
+                snapshot(snapshots.acquire(), i, (uint32_t)food_eaten_since_logged, (uint32_t)fish_eaten_since_logged);
+                snapshots.publish();
+                food_eaten_since_logged = 0;
+                fish_eaten_since_logged = 0;
+            }
+        }
+
+        // always print this
+        std::cout << "TOTAL FISH EATEN: " << fish_eaten_total << endl;
+        std::cout << "TOTAL FOOD EATEN: " << food_eaten_total << endl;
+        if (debug && VERLET_SKIN > 0)
+            std::cout << "verlet lists built " << fish_list_builds << " times in " << NUM_STEPS << " steps" << endl;
+        if (debug && SPATIAL_INDEX == "auto")
+            std::cout << "quadtree built " << fish_tree_builds << " times in " << NUM_STEPS << " steps" << endl;
+
+        if (debug) {
+            snapshots.close();
+            log_thread.join();
+            if (recorder)
+                recorder->finish();
+            else
+                log->finish();
+        }
+    }
+
+    // everything of the json log up to the "steps" array, keys are in the order of the former nlohmann log (sorted)
+    // "firstStep" and "stepInterval" give the steps of the logged frames (see `isLoggedStep`), so that the
+    // visualization can interpolate between them, a flight recorder clip has the step of its kill in "killStep"
+    static void beginJsonLog(JsonWriter& log, const TrajectoryHeader& header) {
+        log.beginObject();
+        log.field("firstStep", (int)header.first_step);
+        log.field("fish_dim_x", C::fish_dim_ellipse_x);
+        log.field("fish_dim_y", C::fish_dim_ellipse_y);
+        if (header.flags & TRAJECTORY_CLIP)
+            log.field("killStep", (int)header.event_step);
+        log.field("numFish", (int)header.num_fish);
+        log.key("scene");
+        log.beginObject();
+        log.field("height", C::height);
+        log.field("width", C::width);
+        log.endObject();
+        log.field("shark_blind_angle_back", C::shark_blind_angle_deg);
+        log.field("shark_dim_x", C::shark_dim_ellipse_x);
+        log.field("shark_dim_y", C::shark_dim_ellipse_y);
+        log.field("shark_kill_radius", C::shark_kill_radius);
+        log.field("shark_sense_dist", C::shark_sense_dist);
+        log.field("stepInterval", (int)header.step_interval);
+        log.key("steps");
+        log.beginArray();
+    }
+
+    int countDeadFish() const {
+        int deadFish = 0;
+        for (size_t i = 0; i < swarm.size(); i++) {
+            if (!swarm.alive[i])
+                deadFish ++;
+        }
+        return deadFish;
+    }
+
+    TrajectoryHeader trajectoryHeader() const {
+        TrajectoryHeader header{};
+        std::memcpy(header.magic, TRAJECTORY_MAGIC, sizeof(header.magic));
+        header.version = TRAJECTORY_VERSION;
+        header.flags = (LOG_DELTA ? TRAJECTORY_DELTA : 0) | (LOG_HEADING_BITS == 8 ? TRAJECTORY_HEADING_8BIT : 0) |
+                       (isFishSubsetLogged() ? TRAJECTORY_FISH_SUBSET : 0) | (C::wall ? TRAJECTORY_WALL : 0);
+        header.width = C::width;
+        header.height = C::height;
+        header.steps = NUM_STEPS;
+        header.num_fish = (uint32_t)swarm.size();
+        header.num_sharks = (uint32_t)sharks.size();
+        header.num_food = (uint32_t)food.size();
+        header.keyframe_interval = LOG_KEYFRAME_INTERVAL;
+        header.fish_dim_x = C::fish_dim_ellipse_x;
+        header.fish_dim_y = C::fish_dim_ellipse_y;
+        header.shark_dim_x = C::shark_dim_ellipse_x;
+        header.shark_dim_y = C::shark_dim_ellipse_y;
+        header.shark_kill_radius = C::shark_kill_radius;
+        header.shark_sense_dist = C::shark_sense_dist;
+        header.shark_blind_angle_back = C::shark_blind_angle_deg;
+        header.first_step = LOG_FROM;
+        header.step_interval = LOG_EVERY;
+        return header;
+    }
+
+    // current state for the log thread
+    void snapshot(StateSnapshot& out, int step, uint32_t eaten_food_counter, uint32_t eaten_fish_counter) const {
+        out.step = step;
+        out.swarm.copyFrom(swarm, fish_slot);  // by fish id, whatever the slots are
+        out.sharks.copyFrom(sharks);
+        out.food.copyFrom(food);
+        out.dead_fish = (uint32_t)countDeadFish();
+        out.eaten_food = eaten_food_counter;
+        out.eaten_fish = eaten_fish_counter;
+    }
+
+    // fish of the snapshot that are logged: given by their ids (LOG_FISH) and/or close to a shark (LOG_NEAR_SHARK)
+    // runs on the log thread, reads only the snapshot
+    static void selectLoggedFish(StateSnapshot& step) {
+        const GroupSnapshot& swarm = step.swarm;
+        const GroupSnapshot& sharks = step.sharks;
+        step.fish_logged.assign(swarm.size(), 1);
+        float max_dist2 = LOG_NEAR_SHARK * LOG_NEAR_SHARK;
+        for (size_t i = 0; i < swarm.size(); i++) {
+            if (!LOG_FISH.empty() && std::find(LOG_FISH.begin(), LOG_FISH.end(), swarm.id[i]) == LOG_FISH.end()) {
+                step.fish_logged[i] = 0;
+                continue;
+            }
+            if (LOG_NEAR_SHARK <= 0)
+                continue;
+            bool near = false;
+            for (size_t si = 0; si < sharks.size() && !near; si++) {
+                float dx = std::abs(swarm.pos_x[i] - sharks.pos_x[si]);
+                float dy = std::abs(swarm.pos_y[i] - sharks.pos_y[si]);
+                if (!C::wall) {
+                    dx = std::min(dx, C::width - dx);
+                    dy = std::min(dy, C::height - dy);
+                }
+                near = dx * dx + dy * dy <= max_dist2;
+            }
+            step.fish_logged[i] = near;
+        }
+    }
+
+    // one step as one element of the "steps" array of the log, only the logged fish are in "swarm"
+    static void logStep(JsonWriter& log, const StateSnapshot& step) {
+        const GroupSnapshot& swarm = step.swarm;
+        const GroupSnapshot& sharks = step.sharks;
+        const GroupSnapshot& food = step.food;
+
+        log.beginObject();
+        log.field("deadFish", (int)step.dead_fish);
+        log.field("eatenFood", (int)step.eaten_food);
+
+        log.key("food");
+        log.beginArray();
+        for (size_t i = 0; i < food.size(); i++) {
+            log.beginObject();
+            log.field("id", food.id[i]);
+            log.field("x", (double)food.pos_x[i]);
+            log.field("y", (double)food.pos_y[i]);
+            log.endObject();
+        }
+        log.endArray();
+
+        log.key("sharks");
+        log.beginArray();
+        for (size_t i = 0; i < sharks.size(); i++) {
+            float direction_radians = atan2(sharks.dir_x[i], sharks.dir_y[i]);
+            log.beginObject();
+            log.field("dir", (double)direction_radians);
+            log.field("id", sharks.id[i]);
+            log.field("x", (double)sharks.pos_x[i]);
+            log.field("y", (double)sharks.pos_y[i]);
+            log.endObject();
+        }
+        log.endArray();
+
+        log.field("step", step.step);
+
+        log.key("swarm");
+        log.beginArray();
+        for (size_t i = 0; i < swarm.size(); i++) {
+            if (!step.fish_logged.empty() && !step.fish_logged[i])
+                continue;
+            float direction_radians = atan2(swarm.dir_x[i], swarm.dir_y[i]);
+            log.beginObject();
+            log.field("alive", (bool)swarm.alive[i]);
+            log.field("dir", (double)direction_radians);
+            log.field("id", swarm.id[i]);
+            log.field("x", (int)swarm.pos_x[i]);
+            log.field("y", (int)swarm.pos_y[i]);
+            log.endObject();
+        }
+        log.endArray();
+
+        log.endObject();
+    }
+};
+
+// fixed set of threads running submitted tasks in the order of submission
+class WorkerPool {
+public:
+    explicit WorkerPool(int num_threads) {
+        for (int i = 0; i < std::max(1, num_threads); i++) {
+            workers.emplace_back([this]() { work(); });
+        }
+    }
+
+    // the queued tasks are still finished
+    ~WorkerPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        task_ready.notify_all();
+        for (std::thread& worker : workers)
+            worker.join();
+    }
+
+    void submit(std::function<void()> task) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            tasks.push_back(std::move(task));
+            pending++;
+        }
+        task_ready.notify_one();
+    }
+
+    // block until all the submitted tasks are done
+    void wait() {
+        std::unique_lock<std::mutex> lock(mutex);
+        all_done.wait(lock, [this]() { return pending == 0; });
+    }
+
+private:
+    vector<std::thread> workers;
+    std::deque<std::function<void()>> tasks;
+    size_t pending = 0;     // submitted tasks that are not finished yet
+    bool stopping = false;
+    std::mutex mutex;
+    std::condition_variable task_ready;
+    std::condition_variable all_done;
+
+    void work() {
+        while (true) {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                task_ready.wait(lock, [this]() { return stopping || !tasks.empty(); });
+                if (tasks.empty())
+                    return;
+                task = std::move(tasks.front());
+                tasks.pop_front();
+            }
+            task();
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                pending--;
+            }
+            all_done.notify_all();
+        }
+    }
+};
+
+// one of many independent simulations (batch mode, Python module)
+struct SimulationRun {
+    int row;            // index of the parameter vector (e.g. in the batch file)
+    int replicate;
+    uint64_t seed;
+    ModelParams params;
+};
+
+// runs the simulations concurrently on `num_threads` workers (0 means all cores), each one on a single thread
+template<typename C>
+vector<SimulationResult> simulateRuns(const vector<SimulationRun>& runs, int num_threads) {
+    vector<SimulationResult> results(runs.size());
+    WorkerPool pool(num_threads > 0 ? num_threads : (int)std::thread::hardware_concurrency());
+    for (size_t i = 0; i < runs.size(); i++) {
+        pool.submit([&runs, &results, i]() {
+#ifdef _OPENMP
+            omp_set_num_threads(1); // the runs themselves are what runs in parallel
+#endif
+            Scene<C> scene(runs[i].params, runs[i].seed);
+            results[i] = scene.run();
+        });
+    }
+    pool.wait();
+    return results;
+}
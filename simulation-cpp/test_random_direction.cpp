@@ -0,0 +1,35 @@
+#include "simulation.hpp"
+
+// random directions must not prefer any side: the mean of many draws is near (0, 0), every quadrant is reached
+// and the components stay within (-1, 1)
+int main() {
+    const int draws = 100000;
+    glm::dvec2 sum(0);
+    int quadrants[4] = {};
+    for (int i = 0; i < draws; i++) {
+        RandomStream rng(1, (uint32_t)i, 0, RandomPurpose::FoodDrift);
+        glm::vec2 dir = getRandomDirection(rng);
+        if (std::abs(dir.x) >= 1 || std::abs(dir.y) >= 1) {
+            std::cerr << "random direction out of range: (" << dir.x << ", " << dir.y << ")" << std::endl;
+            return 1;
+        }
+        sum += glm::dvec2(dir);
+        quadrants[(dir.x < 0) + 2 * (dir.y < 0)]++;
+    }
+
+    // a component is uniform in (-1, 1) with standard deviation 0.58, the mean of the draws deviates by 0.002
+    glm::dvec2 mean = sum / (double)draws;
+    std::cout << "RANDOM DIRECTION MEAN: " << mean.x << " " << mean.y << std::endl;
+    if (std::abs(mean.x) > 0.01 || std::abs(mean.y) > 0.01) {
+        std::cerr << "the mean of the random directions is not near (0, 0)" << std::endl;
+        return 1;
+    }
+    for (int q = 0; q < 4; q++) {
+        if (quadrants[q] < draws / 5) {
+            std::cerr << "quadrant " << q << " got only " << quadrants[q] << " of " << draws << " random directions"
+                      << std::endl;
+            return 1;
+        }
+    }
+    return 0;
+}
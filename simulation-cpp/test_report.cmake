@@ -0,0 +1,52 @@
+# runs one of the reports of the simulation and checks the reported values against bounds
+# cmake -DSIMULATION=<path of cpp_simulation> "-DARGS=<arguments>" "-DBOUNDS=<LABEL><=<max>,<LABEL>>=<min>,..."
+#       -P test_report.cmake
+# a bound refers to the report line "<LABEL>: <value>", the labels must not contain commas
+
+separate_arguments(REPORT_ARGS UNIX_COMMAND "${ARGS}")
+execute_process(
+    COMMAND "${SIMULATION}" ${REPORT_ARGS}
+    OUTPUT_VARIABLE OUTPUT
+    ERROR_VARIABLE ERROR
+    RESULT_VARIABLE RESULT)
+if(NOT RESULT EQUAL 0)
+    message(FATAL_ERROR "${ARGS}: the simulation failed (${RESULT}): ${ERROR}")
+endif()
+
+string(REPLACE "," ";" BOUNDS "${BOUNDS}")
+set(FAILED "")
+foreach(BOUND IN LISTS BOUNDS)
+    if(NOT BOUND MATCHES "^(.+)(<=|>=)(.+)$")
+        message(FATAL_ERROR "invalid bound '${BOUND}'")
+    endif()
+    set(LABEL "${CMAKE_MATCH_1}")
+    set(RELATION "${CMAKE_MATCH_2}")
+    set(LIMIT "${CMAKE_MATCH_3}")
+
+    # the value after the label, up to the end of its line
+    string(FIND "${OUTPUT}" "${LABEL}: " AT)
+    if(AT LESS 0)
+        list(APPEND FAILED "${LABEL}: not reported")
+        continue()
+    endif()
+    string(LENGTH "${LABEL}: " LABEL_LENGTH)
+    math(EXPR AT "${AT} + ${LABEL_LENGTH}")
+    string(SUBSTRING "${OUTPUT}" ${AT} -1 VALUE)
+    string(REGEX REPLACE "\n.*" "" VALUE "${VALUE}")
+
+    # a NaN or anything else that is not a number fails too
+    if(NOT VALUE MATCHES "^-?[0-9.]+(e[-+]?[0-9]+)?$")
+        list(APPEND FAILED "${LABEL}: ${VALUE} is not a number")
+    elseif(RELATION STREQUAL "<=" AND VALUE GREATER LIMIT)
+        list(APPEND FAILED "${LABEL}: ${VALUE} is above ${LIMIT}")
+    elseif(RELATION STREQUAL ">=" AND VALUE LESS LIMIT)
+        list(APPEND FAILED "${LABEL}: ${VALUE} is below ${LIMIT}")
+    else()
+        message(STATUS "${LABEL}: ${VALUE} (${RELATION} ${LIMIT})")
+    endif()
+endforeach()
+
+if(FAILED)
+    list(JOIN FAILED "\n  " FAILED)
+    message(FATAL_ERROR "${ARGS}:\n  ${FAILED}")
+endif()
@@ -0,0 +1,42 @@
+# re-sorting the fish slots (--sort-every) must not change the results: runs the same seed with and without it for
+# every neighbour index mode, in place and synchronous, and compares the binary logs
+# cmake -DSIMULATION=<path of cpp_simulation> -DWORK_DIR=<directory for the logs> -P test_sort_every.cmake
+
+set(MODES
+    "--spatial-index grid"
+    "--spatial-index quadtree"
+    "--spatial-index auto"
+    "--fish-neighbours 7"
+    "--fish-neighbours 7 --spatial-index quadtree"
+    "--mean-field 2"
+    "--verlet-skin 2"
+    "--verlet-skin 8 --spatial-index quadtree")
+
+file(MAKE_DIRECTORY "${WORK_DIR}")
+set(FAILED "")
+foreach(MODE IN LISTS MODES)
+    separate_arguments(MODE_ARGS UNIX_COMMAND "${MODE}")
+    foreach(SYNC false true)
+        foreach(SORT 0 7)
+            execute_process(
+                COMMAND "${SIMULATION}" --seed 3 --num-steps 150 --sync ${SYNC} --sort-every ${SORT} ${MODE_ARGS}
+                        --log-format binary --log-filepath "${WORK_DIR}/sort_every_${SORT}.bin"
+                OUTPUT_QUIET
+                RESULT_VARIABLE RESULT)
+            if(NOT RESULT EQUAL 0)
+                message(FATAL_ERROR "${MODE} --sync ${SYNC} --sort-every ${SORT}: the simulation failed (${RESULT})")
+            endif()
+        endforeach()
+        file(SHA256 "${WORK_DIR}/sort_every_0.bin" UNSORTED)
+        file(SHA256 "${WORK_DIR}/sort_every_7.bin" SORTED)
+        if(NOT UNSORTED STREQUAL SORTED)
+            list(APPEND FAILED "${MODE} --sync ${SYNC}")
+        endif()
+    endforeach()
+endforeach()
+
+file(REMOVE "${WORK_DIR}/sort_every_0.bin" "${WORK_DIR}/sort_every_7.bin")
+if(FAILED)
+    list(JOIN FAILED "\n  " FAILED)
+    message(FATAL_ERROR "--sort-every changed the results of:\n  ${FAILED}")
+endif()
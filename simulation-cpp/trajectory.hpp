@@ -0,0 +1,609 @@
+#pragma once
+
+// binary trajectory log (--log-format binary), a compact alternative to the json log for visualization
+//
+// all numbers are little-endian, the file is a header followed by one frame per step:
+//
+//   header (80 B)   magic "FSTR", u16 version, u16 flags, u32 width, height, steps, fish, sharks, food,
+//                   u32 keyframe interval, f32 fish dim x/y, shark dim x/y, shark kill radius, shark sense dist,
+//                   shark blind angle back (degrees), u32 first step, u32 step interval, u32 event step,
+//                   4 B reserved
+//                   (versions 1 and 2 have the first 64 B only, every step is a frame)
+//   frame           u32 size of the rest of the frame, u8 kind (key/delta), 3 B padding, u32 dead fish,
+//                   u32 eaten food (since the previous frame), logged fish bits (only with the fish subset flag),
+//                   channels (fish x, y, heading, shark x, y, heading, food x, y), fish alive bits,
+//                   padding to a multiple of 4 B
+//   index           u64 file offset of every frame
+//   footer (16 B)   u64 file offset of the index, u32 number of frames, magic "FIDX"
+//
+// positions are quantized to 16-bit fixed point of the scene size, headings (atan2(dir x, dir y), the angle
+// of the json log) to 16 or 8 bits of the full turn
+// key frames store the channels as plain u16 (u8 for 8-bit headings) arrays, 2 B aligned within the file
+// delta frames store every value as the zigzag varint of its difference from a prediction (modulo the
+// quantization range, so that wrapping around the scene costs nothing), the prediction is linear from the
+// two previous frames (only the previous one right after a key frame)
+// a key frame comes every `keyframe interval` frames, so decoding can start at any of them
+// the index is written when the run finishes, a file without it (the run did not finish) can still be read
+// frame by frame from the beginning
+// frame k is the state after the step `first step + k * step interval`
+// with the fish subset flag only some fish are logged in a frame (their bit is set, bits are LSB first), the fish
+// channels hold only the logged ones, the prediction of a fish uses only the frames it was logged in (it is
+// stored plainly in the first frame after a gap), a fish not logged in a key frame reads as zero until it is logged
+// a file with the clip flag holds only the frames around an event (a kill caught by the flight recorder), the
+// event step is the step of that kill
+
+#include <vector>
+#include <array>
+#include <span>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <ostream>
+#include <bit>
+#include <string>
+#include <stdexcept>
+#include <algorithm>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static_assert(std::endian::native == std::endian::little, "the trajectory format is written as in memory");
+
+inline constexpr char TRAJECTORY_MAGIC[4] = {'F', 'S', 'T', 'R'};
+inline constexpr char TRAJECTORY_INDEX_MAGIC[4] = {'F', 'I', 'D', 'X'};
+inline constexpr uint16_t TRAJECTORY_VERSION = 3;   // 1 had no index, 2 had no step numbering and fish subsets
+inline constexpr uint16_t TRAJECTORY_DELTA = 1 << 0;          // flag: frames between key frames are delta frames
+inline constexpr uint16_t TRAJECTORY_HEADING_8BIT = 1 << 1;   // flag: headings have 8 bits instead of 16
+inline constexpr uint16_t TRAJECTORY_FISH_SUBSET = 1 << 2;    // flag: frames log only some fish (see above)
+inline constexpr uint16_t TRAJECTORY_WALL = 1 << 3;           // flag: the scene has walls (else it wraps around)
+inline constexpr uint16_t TRAJECTORY_CLIP = 1 << 4;           // flag: a clip around the event step (see above)
+
+struct TrajectoryHeader {
+    char magic[4];
+    uint16_t version;
+    uint16_t flags;
+    uint32_t width, height;
+    uint32_t steps;
+    uint32_t num_fish, num_sharks, num_food;
+    uint32_t keyframe_interval;
+    float fish_dim_x, fish_dim_y;
+    float shark_dim_x, shark_dim_y;
+    float shark_kill_radius;
+    float shark_sense_dist;
+    float shark_blind_angle_back;
+    uint32_t first_step;
+    uint32_t step_interval;
+    uint32_t event_step;
+    uint32_t reserved;
+};
+static_assert(sizeof(TrajectoryHeader) == 80);
+
+inline size_t trajectoryHeaderSize(uint16_t version) {
+    return version >= 3 ? sizeof(TrajectoryHeader) : 64;
+}
+
+enum class FrameKind : uint8_t {
+    Key = 0,
+    Delta = 1,
+};
+
+// fixed part of every frame, the channels follow
+struct FrameHeader {
+    uint32_t size;      // bytes after this field
+    FrameKind kind;
+    uint8_t padding[3];
+    uint32_t dead_fish;
+    uint32_t eaten_food;
+};
+static_assert(sizeof(FrameHeader) == 16);
+
+// last bytes of the file, locate the index
+struct TrajectoryFooter {
+    uint64_t index_offset;
+    uint32_t frames;
+    char magic[4];
+};
+static_assert(sizeof(TrajectoryFooter) == 16);
+
+// quantized channels of a frame: fish x, y, heading, shark x, y, heading, food x, y
+inline constexpr int TRAJECTORY_CHANNELS = 8;
+
+inline std::array<uint32_t, TRAJECTORY_CHANNELS> channelSizes(const TrajectoryHeader& header) {
+    return {header.num_fish, header.num_fish, header.num_fish, header.num_sharks, header.num_sharks,
+            header.num_sharks, header.num_food, header.num_food};
+}
+
+// number of quantization levels of every channel
+inline std::array<uint32_t, TRAJECTORY_CHANNELS> channelRanges(const TrajectoryHeader& header) {
+    uint32_t heading = (header.flags & TRAJECTORY_HEADING_8BIT) ? 256 : 65536;
+    return {65536, 65536, heading, 65536, 65536, heading, 65536, 65536};
+}
+
+// state of one step, as given to the writer (views of the entity stores)
+// `fish_logged` selects the fish written with the fish subset flag (all if empty)
+struct TrajectoryFrame {
+    std::span<const float> fish_x, fish_y, fish_dir_x, fish_dir_y;
+    std::span<const unsigned char> fish_alive;
+    std::span<const unsigned char> fish_logged;
+    std::span<const float> shark_x, shark_y, shark_dir_x, shark_dir_y;
+    std::span<const float> food_x, food_y;
+    uint32_t dead_fish;
+    uint32_t eaten_food;
+};
+
+// position in [0, size] to 16-bit fixed point
+inline uint16_t quantizePosition(float v, float size) {
+    float q = std::floor(v / size * 65536.0f);
+    return (uint16_t)std::clamp(q, 0.0f, 65535.0f);
+}
+
+// heading of the direction (the angle used by the json log) to `bits` bits of the full turn
+inline uint16_t quantizeHeading(float dir_x, float dir_y, int bits) {
+    float turns = std::atan2(dir_x, dir_y) * (float)(0.5 / M_PI);
+    long q = std::lround(turns * (float)(1 << bits));
+    return (uint16_t)(q & ((1 << bits) - 1));
+}
+
+inline float dequantizePosition(uint16_t q, float size) {
+    return ((float)q + 0.5f) * size * (1.0f / 65536.0f);
+}
+
+// back to radians in [-pi, pi), `range` is the number of levels
+inline float dequantizeHeading(uint16_t q, uint32_t range) {
+    float turns = (float)q / (float)range;
+    return (turns >= 0.5f ? turns - 1.0f : turns) * (float)(2 * M_PI);
+}
+
+inline uint32_t zigzag(int32_t v) {
+    return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+}
+
+inline int32_t unzigzag(uint32_t v) {
+    return (int32_t)(v >> 1) ^ -(int32_t)(v & 1);
+}
+
+// prediction of a quantized value from the previous frames: none (order 0), the previous value (order 1),
+// or linear from the two previous values (order 2)
+inline uint32_t predictValue(int order, uint16_t previous, uint16_t before_previous) {
+    if (order == 0)
+        return 0;
+    uint32_t predicted = previous;
+    if (order == 2)
+        predicted += (uint32_t)previous - before_previous;
+    return predicted;
+}
+
+// number of previous frames (up to 2) a value can be predicted from
+inline void updateStreaks(std::vector<uint8_t>& streaks, std::span<const uint8_t> logged, bool key) {
+    for (size_t i = 0; i < streaks.size(); i++)
+        streaks[i] = !logged[i] ? 0 : key ? 1 : (uint8_t)std::min(streaks[i] + 1, 2);
+}
+
+inline bool bit(const uint8_t* bits, size_t i) {
+    return (bits[i / 8] >> (i % 8)) & 1;
+}
+
+// writes the frames of one run as they come, keeps only the quantized channels of the two previous frames
+class TrajectoryWriter {
+public:
+    static constexpr int NUM_CHANNELS = TRAJECTORY_CHANNELS;
+
+    TrajectoryWriter(std::ostream& out, const TrajectoryHeader& header)
+            : out(out), header(header), sizes(channelSizes(header)), ranges(channelRanges(header)) {
+        out.write((const char*)&header, sizeof(header));
+        for (int c = 0; c < NUM_CHANNELS; c++) {
+            current[c].resize(sizes[c]);
+            previous[c].resize(sizes[c]);
+            before_previous[c].resize(sizes[c]);
+            streaks[c].resize(sizes[c]);
+        }
+        logged.assign(header.num_fish, 1);
+        everything.assign(std::max({header.num_fish, header.num_sharks, header.num_food}), 1);
+    }
+
+    void write(const TrajectoryFrame& frame) {
+        for (int c = 0; c < NUM_CHANNELS; c++) {
+            std::swap(before_previous[c], previous[c]);
+            std::swap(previous[c], current[c]);
+        }
+        bool subset = header.flags & TRAJECTORY_FISH_SUBSET;
+        for (size_t i = 0; i < header.num_fish; i++)
+            logged[i] = !subset || frame.fish_logged.empty() || frame.fish_logged[i];
+        bool key = !(header.flags & TRAJECTORY_DELTA) || frames % header.keyframe_interval == 0;
+        quantize(frame, key);
+
+        buffer.clear();
+        if (subset)
+            putBits(logged);
+        for (int c = 0; c < NUM_CHANNELS; c++) {
+            std::span<const uint8_t> in_frame = c < 3 ? std::span<const uint8_t>(logged)
+                                                      : std::span<const uint8_t>(everything).first(sizes[c]);
+            if (key)
+                putPlain(c, in_frame);
+            else
+                putDelta(c, in_frame);
+            updateStreaks(streaks[c], in_frame, key);
+        }
+        putBits(frame.fish_alive);
+        buffer.resize((buffer.size() + 3) / 4 * 4, 0);
+
+        FrameHeader frame_header{};
+        frame_header.size = (uint32_t)(sizeof(FrameHeader) - sizeof(uint32_t) + buffer.size());
+        frame_header.kind = key ? FrameKind::Key : FrameKind::Delta;
+        frame_header.dead_fish = frame.dead_fish;
+        frame_header.eaten_food = frame.eaten_food;
+        out.write((const char*)&frame_header, sizeof(frame_header));
+        out.write((const char*)buffer.data(), (std::streamsize)buffer.size());
+        offsets.push_back(position);
+        position += sizeof(frame_header) + buffer.size();
+        frames++;
+    }
+
+    // the frame index, after the last frame
+    void finish() {
+        out.write((const char*)offsets.data(), (std::streamsize)(offsets.size() * sizeof(uint64_t)));
+        TrajectoryFooter footer{position, frames, {}};
+        std::memcpy(footer.magic, TRAJECTORY_INDEX_MAGIC, sizeof(footer.magic));
+        out.write((const char*)&footer, sizeof(footer));
+    }
+
+private:
+    // fish that are not logged keep their last values, a key frame resets them to zero (see `DecodedFrame`)
+    void quantize(const TrajectoryFrame& frame, bool key) {
+        int heading_bits = (header.flags & TRAJECTORY_HEADING_8BIT) ? 8 : 16;
+        float width = (float)header.width, height = (float)header.height;
+        for (size_t i = 0; i < header.num_fish; i++) {
+            if (!logged[i]) {
+                for (int c = 0; c < 3; c++)
+                    current[c][i] = key ? 0 : previous[c][i];
+                continue;
+            }
+            current[0][i] = quantizePosition(frame.fish_x[i], width);
+            current[1][i] = quantizePosition(frame.fish_y[i], height);
+            current[2][i] = quantizeHeading(frame.fish_dir_x[i], frame.fish_dir_y[i], heading_bits);
+        }
+        for (size_t i = 0; i < header.num_sharks; i++) {
+            current[3][i] = quantizePosition(frame.shark_x[i], width);
+            current[4][i] = quantizePosition(frame.shark_y[i], height);
+            current[5][i] = quantizeHeading(frame.shark_dir_x[i], frame.shark_dir_y[i], heading_bits);
+        }
+        for (size_t i = 0; i < header.num_food; i++) {
+            current[6][i] = quantizePosition(frame.food_x[i], width);
+            current[7][i] = quantizePosition(frame.food_y[i], height);
+        }
+    }
+
+    void putBits(std::span<const unsigned char> values) {
+        size_t at = buffer.size();
+        buffer.resize(at + (values.size() + 7) / 8, 0);
+        for (size_t i = 0; i < values.size(); i++) {
+            if (values[i])
+                buffer[at + i / 8] |= (uint8_t)(1 << (i % 8));
+        }
+    }
+
+    // plain values of the entities in the frame, u16 channels are aligned to 2 B (the frame header keeps the
+    // alignment of 4 B)
+    void putPlain(int c, std::span<const uint8_t> in_frame) {
+        if (ranges[c] != 256)
+            buffer.resize((buffer.size() + 1) / 2 * 2, 0);
+        for (size_t i = 0; i < current[c].size(); i++) {
+            if (!in_frame[i])
+                continue;
+            uint16_t v = current[c][i];
+            if (ranges[c] == 256) {
+                buffer.push_back((uint8_t)v);
+            } else {
+                buffer.push_back((uint8_t)v);
+                buffer.push_back((uint8_t)(v >> 8));
+            }
+        }
+    }
+
+    // residuals of the prediction, wrapped to the signed half of the range, as zigzag varints
+    void putDelta(int c, std::span<const uint8_t> in_frame) {
+        uint32_t range = ranges[c];
+        for (size_t i = 0; i < current[c].size(); i++) {
+            if (!in_frame[i])
+                continue;
+            uint32_t predicted = predictValue(streaks[c][i], previous[c][i], before_previous[c][i]);
+            uint32_t difference = (current[c][i] - predicted) & (range - 1);
+            int32_t residual = difference >= range / 2 ? (int32_t)difference - (int32_t)range : (int32_t)difference;
+            for (uint32_t v = zigzag(residual); ; v >>= 7) {
+                if (v < 0x80) {
+                    buffer.push_back((uint8_t)v);
+                    break;
+                }
+                buffer.push_back((uint8_t)(v | 0x80));
+            }
+        }
+    }
+
+    std::ostream& out;
+    TrajectoryHeader header;
+    uint32_t frames = 0;
+    uint64_t position = sizeof(TrajectoryHeader);   // file offset of the next frame
+    std::vector<uint64_t> offsets;                  // of all frames written, for the index (8 B per step)
+    std::array<uint32_t, NUM_CHANNELS> sizes;
+    std::array<uint32_t, NUM_CHANNELS> ranges;
+    std::array<std::vector<uint16_t>, NUM_CHANNELS> current, previous, before_previous;
+    std::array<std::vector<uint8_t>, NUM_CHANNELS> streaks;   // order of the prediction of every value
+    std::vector<uint8_t> logged;       // fish in the frame being written
+    std::vector<uint8_t> everything;   // all sharks and food are in every frame
+    std::vector<uint8_t> buffer;       // channels of the frame being written
+};
+
+// one frame of a trajectory, positions in scene units and headings in radians (the angles of the json log)
+// fish that are not logged in the frame keep the values of the last frame they were logged in since the last key
+// frame, and are zero if there is none, so a frame decodes the same whichever frame was decoded before it
+struct DecodedFrame {
+    size_t step = 0;                // simulation step of the frame
+    uint32_t dead_fish = 0;
+    uint32_t eaten_food = 0;        // since the previous frame
+    std::vector<float> fish_x, fish_y, fish_dir;
+    std::vector<uint8_t> fish_alive;
+    std::vector<uint8_t> fish_logged;
+    std::vector<float> shark_x, shark_y, shark_dir;
+    std::vector<float> food_x, food_y;
+};
+
+// random access to the frames of a binary trajectory, the file is memory-mapped and only the frames needed
+// are decoded: a frame is decoded from the closest key frame before it, consecutive frames continue from the
+// previous one
+// throws std::runtime_error if the file cannot be read or is not a trajectory
+class TrajectoryReader {
+public:
+    explicit TrajectoryReader(const std::string& path) {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            throw std::runtime_error("cannot open " + path);
+        struct stat st{};
+        if (::fstat(fd, &st) == 0 && st.st_size >= 64) {
+            length = (size_t)st.st_size;
+            void* mapped = ::mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+            data = mapped == MAP_FAILED ? nullptr : (const uint8_t*)mapped;
+        }
+        ::close(fd);
+        if (!data)
+            throw std::runtime_error("cannot map " + path);
+
+        std::memcpy(&file_header, data, 64);
+        if (std::memcmp(file_header.magic, TRAJECTORY_MAGIC, sizeof(file_header.magic)) != 0 ||
+            file_header.version < 1 || file_header.version > TRAJECTORY_VERSION ||
+            length < trajectoryHeaderSize(file_header.version)) {
+            unmap();
+            throw std::runtime_error(path + " is not a trajectory of a supported version");
+        }
+        if (file_header.version >= 3) {
+            std::memcpy(&file_header, data, sizeof(file_header));
+        } else {
+            file_header.first_step = 0;
+            file_header.step_interval = 1;
+        }
+        sizes = channelSizes(file_header);
+        ranges = channelRanges(file_header);
+        for (int c = 0; c < TRAJECTORY_CHANNELS; c++) {
+            current[c].resize(sizes[c]);
+            previous[c].resize(sizes[c]);
+            before_previous[c].resize(sizes[c]);
+            streaks[c].resize(sizes[c]);
+        }
+        logged.assign(file_header.num_fish, 1);
+        everything.assign(std::max({file_header.num_fish, file_header.num_sharks, file_header.num_food}), 1);
+        readIndex();
+    }
+
+    TrajectoryReader(const TrajectoryReader&) = delete;
+    TrajectoryReader& operator=(const TrajectoryReader&) = delete;
+
+    ~TrajectoryReader() { unmap(); }
+
+    const TrajectoryHeader& header() const { return file_header; }
+
+    // number of frames in the file
+    size_t size() const { return offsets.size(); }
+
+    // simulation step of a frame
+    size_t step(size_t index) const { return file_header.first_step + index * (size_t)file_header.step_interval; }
+
+    // first frame of the step or after it
+    size_t frameAt(size_t step) const {
+        if (step <= file_header.first_step)
+            return 0;
+        size_t interval = file_header.step_interval;
+        return std::min(size(), (step - file_header.first_step + interval - 1) / interval);
+    }
+
+    DecodedFrame frame(size_t index) {
+        DecodedFrame out;
+        seek(index);
+        dequantize(index, out);
+        return out;
+    }
+
+    // calls `f(const DecodedFrame&)` for the frames [first, last) in order, the frame is reused between the calls
+    template<typename F>
+    void frames(size_t first, size_t last, F f) {
+        DecodedFrame out;
+        for (size_t index = first; index < std::min(last, size()); index++) {
+            seek(index);
+            dequantize(index, out);
+            f((const DecodedFrame&)out);
+        }
+    }
+
+private:
+    // index from the footer, or the frames are walked through if it is missing
+    void readIndex() {
+        TrajectoryFooter footer{};
+        if (file_header.version >= 2 && length >= trajectoryHeaderSize(file_header.version) + sizeof(footer)) {
+            std::memcpy(&footer, data + length - sizeof(footer), sizeof(footer));
+            bool valid = std::memcmp(footer.magic, TRAJECTORY_INDEX_MAGIC, sizeof(footer.magic)) == 0 &&
+                         footer.index_offset <= length &&
+                         footer.index_offset + footer.frames * sizeof(uint64_t) + sizeof(footer) == length;
+            if (valid) {
+                offsets.resize(footer.frames);
+                std::memcpy(offsets.data(), data + footer.index_offset, footer.frames * sizeof(uint64_t));
+                // the frames must lie between the header and the index
+                for (uint64_t offset : offsets) {
+                    if (!frameFits(offset, footer.index_offset))
+                        throw std::runtime_error("the index of the trajectory points outside of its frames");
+                }
+                return;
+            }
+        }
+        for (uint64_t offset = trajectoryHeaderSize(file_header.version); offset + sizeof(FrameHeader) <= length; ) {
+            if (!frameFits(offset, length))
+                break;
+            uint32_t size;
+            std::memcpy(&size, data + offset, sizeof(size));
+            offsets.push_back(offset);
+            offset += sizeof(uint32_t) + size;
+        }
+    }
+
+    // a whole frame, with at least its header, starts at `offset` and ends before `end`
+    bool frameFits(uint64_t offset, uint64_t end) const {
+        if (offset < trajectoryHeaderSize(file_header.version) || offset > end || end - offset < sizeof(FrameHeader))
+            return false;
+        uint32_t size;
+        std::memcpy(&size, data + offset, sizeof(size));
+        return size >= sizeof(FrameHeader) - sizeof(uint32_t) && size <= end - offset - sizeof(uint32_t);
+    }
+
+    FrameHeader frameHeader(size_t index) const {
+        FrameHeader frame_header;
+        std::memcpy(&frame_header, data + offsets[index], sizeof(frame_header));
+        return frame_header;
+    }
+
+    // decodes the quantized channels of frame `index` into `current`
+    void seek(size_t index) {
+        if (index >= size())
+            throw std::out_of_range("trajectory has " + std::to_string(size()) + " frames");
+        if (decoded == index)
+            return;
+        size_t key = index;
+        while (frameHeader(key).kind != FrameKind::Key) {
+            if (key == 0)
+                throw std::runtime_error("trajectory does not start with a key frame");
+            key--;
+        }
+        size_t from = (decoded != NONE && decoded >= key && decoded < index) ? decoded + 1 : key;
+        decoded = NONE;   // until the decoding succeeded
+        for (size_t k = from; k <= index; k++)
+            decode(k);
+        decoded = index;
+    }
+
+    // throws std::runtime_error if the frame is truncated or corrupt, rather than reading past its end
+    void decode(size_t index) {
+        for (int c = 0; c < TRAJECTORY_CHANNELS; c++) {
+            std::swap(before_previous[c], previous[c]);
+            std::swap(previous[c], current[c]);
+        }
+        FrameHeader frame_header = frameHeader(index);
+        bool key = frame_header.kind == FrameKind::Key;
+        const uint8_t* p = data + offsets[index] + sizeof(FrameHeader);
+        const uint8_t* end = data + offsets[index] + sizeof(uint32_t) + frame_header.size;
+        auto need = [&](size_t bytes) {
+            if ((size_t)(end - p) < bytes)
+                throw std::runtime_error("frame " + std::to_string(index) + " of the trajectory is truncated");
+        };
+        if (file_header.flags & TRAJECTORY_FISH_SUBSET) {
+            need((file_header.num_fish + 7) / 8);
+            for (size_t i = 0; i < file_header.num_fish; i++)
+                logged[i] = bit(p, i);
+            p += (file_header.num_fish + 7) / 8;
+        }
+        for (int c = 0; c < TRAJECTORY_CHANNELS; c++) {
+            std::span<const uint8_t> in_frame = c < 3 ? std::span<const uint8_t>(logged)
+                                                      : std::span<const uint8_t>(everything).first(sizes[c]);
+            std::vector<uint16_t>& values = current[c];
+            uint32_t mask = ranges[c] - 1;
+            if (key && ranges[c] != 256) {
+                need((p - data) & 1);
+                p += (p - data) & 1;
+            }
+            for (size_t i = 0; i < values.size(); i++) {
+                if (!in_frame[i]) {
+                    values[i] = key ? 0 : previous[c][i];
+                } else if (key && ranges[c] == 256) {
+                    need(1);
+                    values[i] = *p++;
+                } else if (key) {
+                    need(2);
+                    values[i] = (uint16_t)(p[0] | (p[1] << 8));
+                    p += 2;
+                } else {
+                    uint32_t v = 0;
+                    for (int shift = 0; ; shift += 7) {
+                        need(1);
+                        if (shift > 28)
+                            throw std::runtime_error("frame " + std::to_string(index) + " of the trajectory is corrupt");
+                        uint8_t b = *p++;
+                        v |= (uint32_t)(b & 0x7f) << shift;
+                        if (!(b & 0x80))
+                            break;
+                    }
+                    uint32_t predicted = predictValue(streaks[c][i], previous[c][i], before_previous[c][i]);
+                    values[i] = (uint16_t)((predicted + (uint32_t)unzigzag(v)) & mask);
+                }
+            }
+            updateStreaks(streaks[c], in_frame, key);
+        }
+        need((file_header.num_fish + 7) / 8);
+        alive_bits = p;
+    }
+
+    void dequantize(size_t index, DecodedFrame& out) const {
+        FrameHeader frame_header = frameHeader(index);
+        out.step = step(index);
+        out.dead_fish = frame_header.dead_fish;
+        out.eaten_food = frame_header.eaten_food;
+        float width = (float)file_header.width, height = (float)file_header.height;
+        auto positions = [](const std::vector<uint16_t>& q, float size, std::vector<float>& values) {
+            values.resize(q.size());
+            for (size_t i = 0; i < q.size(); i++)
+                values[i] = dequantizePosition(q[i], size);
+        };
+        auto headings = [](const std::vector<uint16_t>& q, uint32_t range, std::vector<float>& values) {
+            values.resize(q.size());
+            for (size_t i = 0; i < q.size(); i++)
+                values[i] = dequantizeHeading(q[i], range);
+        };
+        positions(current[0], width, out.fish_x);
+        positions(current[1], height, out.fish_y);
+        headings(current[2], ranges[2], out.fish_dir);
+        positions(current[3], width, out.shark_x);
+        positions(current[4], height, out.shark_y);
+        headings(current[5], ranges[5], out.shark_dir);
+        positions(current[6], width, out.food_x);
+        positions(current[7], height, out.food_y);
+        out.fish_alive.resize(file_header.num_fish);
+        for (size_t i = 0; i < file_header.num_fish; i++)
+            out.fish_alive[i] = bit(alive_bits, i);
+        out.fish_logged = logged;
+    }
+
+    void unmap() {
+        if (data)
+            ::munmap((void*)data, length);
+        data = nullptr;
+    }
+
+    static constexpr size_t NONE = (size_t)-1;
+
+    const uint8_t* data = nullptr;
+    size_t length = 0;
+    TrajectoryHeader file_header{};
+    std::vector<uint64_t> offsets;  // file offset of every frame
+    std::array<uint32_t, TRAJECTORY_CHANNELS> sizes{}, ranges{};
+    std::array<std::vector<uint16_t>, TRAJECTORY_CHANNELS> current, previous, before_previous;
+    std::array<std::vector<uint8_t>, TRAJECTORY_CHANNELS> streaks;   // order of the prediction of every value
+    std::vector<uint8_t> logged;           // fish in the decoded frame
+    std::vector<uint8_t> everything;       // all sharks and food are in every frame
+    const uint8_t* alive_bits = nullptr;   // of the decoded frame
+    size_t decoded = NONE;                 // frame whose channels are in `current`
+};
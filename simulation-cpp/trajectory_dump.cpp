@@ -0,0 +1,77 @@
+// prints frames of a binary trajectory log (see trajectory.hpp) as TSV, without reading the rest of the file
+//
+//   ./trajectory_dump --log-filepath output.bin --first 900 --last 910
+//   ./trajectory_dump --log-filepath output.bin --summary
+
+#include <iostream>
+#include <string>
+#include <boost/program_options.hpp>
+#include "trajectory.hpp"
+
+using std::string;
+
+int main(int argc, char** argv) {
+    string log_filepath = "output.bin";
+    size_t first = 0;
+    size_t last = (size_t)-1;
+    size_t every = 1;
+    bool summary = false;
+
+    boost::program_options::options_description desc("Allowed options");
+    desc.add_options()
+            ("help", "prints help")
+            ("log-filepath", boost::program_options::value<string>(&log_filepath), "Binary trajectory to read")
+            ("first", boost::program_options::value<size_t>(&first), "First step to print")
+            ("last", boost::program_options::value<size_t>(&last), "Step after the last one to print (default: all)")
+            ("every", boost::program_options::value<size_t>(&every), "Print only every n-th logged frame of the range")
+            ("summary", boost::program_options::bool_switch(&summary), "Print one line per step (dead fish, eaten food) instead of all entities");
+    boost::program_options::variables_map vm;
+    boost::program_options::store(boost::program_options::parse_command_line(argc, argv, desc), vm);
+    boost::program_options::notify(vm);
+    if (vm.count("help")) {
+        std::cout << desc << std::endl;
+        return 0;
+    }
+    if (every == 0) {
+        std::cerr << "every must be positive" << std::endl;
+        return 1;
+    }
+
+    try {
+        TrajectoryReader reader(log_filepath);
+        if (summary)
+            std::cout << "step\tdead_fish\teaten_food\n";
+        else
+            std::cout << "step\tentity\tindex\tx\ty\tdir\talive\n";
+
+        // logged frames of the steps [first, last)
+        size_t last_frame = last == (size_t)-1 ? reader.size() : reader.frameAt(last);
+        for (size_t index = reader.frameAt(first); index < last_frame; index += every) {
+            // consecutive frames continue decoding from the previous one, sampled ones seek to their key frame
+            DecodedFrame frame = reader.frame(index);
+            size_t step = frame.step;
+            if (summary) {
+                std::cout << step << '\t' << frame.dead_fish << '\t' << frame.eaten_food << '\n';
+                continue;
+            }
+            for (size_t i = 0; i < frame.fish_x.size(); i++) {
+                if (!frame.fish_logged[i])
+                    continue;
+                std::cout << step << "\tfish\t" << i << '\t' << frame.fish_x[i] << '\t' << frame.fish_y[i] << '\t'
+                          << frame.fish_dir[i] << '\t' << (int)frame.fish_alive[i] << '\n';
+            }
+            for (size_t i = 0; i < frame.shark_x.size(); i++) {
+                std::cout << step << "\tshark\t" << i << '\t' << frame.shark_x[i] << '\t' << frame.shark_y[i] << '\t'
+                          << frame.shark_dir[i] << "\t1\n";
+            }
+            for (size_t i = 0; i < frame.food_x.size(); i++) {
+                std::cout << step << "\tfood\t" << i << '\t' << frame.food_x[i] << '\t' << frame.food_y[i]
+                          << "\t0\t1\n";
+            }
+        }
+    } catch (const std::exception& e) {
+        std::cerr << log_filepath << ": " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -6,23 +6,22 @@ let logger = {
     // next two values are placeholders, values are set in setup() function
     stepsTotal: 1000, // save steps num to be able to freeze the last step
     currentFrameRate: 30,
+    paused: false,
 }
 let frameRateButton1, frameRateButton2;
+let stepSlider, pauseButton;
 let initFrameRate = 30;
 let output;
 let stepCounter;
 
-fetch('../output.json')
-    .then(response => response.json())
-    .then(data => {
-        output = data
-    })
-    .catch(error => console.error(error));
+// log to visualize, the JSON log or the binary trajectory format (see simulation-cpp/trajectory.hpp)
+// another one can be given in the URL, e.g. index.html?log=../output.bin
+let logUrl = new URLSearchParams(window.location.search).get('log') || '../output.json';
 
 function setup() {
-    fetch('../output.json')
-        .then(response => response.json())
-        .then(output => {
+    loadTrajectory(logUrl)
+        .then(trajectory => {
+            output = trajectory
             createCanvas(output.scene.width, output.scene.height);
             console.log(output);
 
@@ -35,8 +34,9 @@ function setup() {
             // create new HTML paragraph element to display dead fish counter
             eatenFoodCounter = createP("Eaten food pieces: " + 0);
 
-            // save max num of steps
-            logger.stepsTotal = output.stepsTotal;
+            // save max num of steps, the log may cover only some of them
+            logger.step = output.firstStep - 1;
+            logger.stepsTotal = output.lastStep + 1;
 
             // save frame rate
             logger.frameRate = initFrameRate
@@ -55,10 +55,401 @@ function setup() {
             // create new HTML paragraph element to display dead fish counter
             frameRateButton = createP("Frame Rate: " + logger.frameRate);
 
+            // slider to seek to any step (scrubbing works while playing or paused)
+            stepSlider = createSlider(output.firstStep, output.lastStep, output.firstStep, 1);
+            stepSlider.style('width', output.scene.width + 'px');
+            stepSlider.input(() => seek(stepSlider.value()));
+            pauseButton = createButton("Pause");
+            pauseButton.mouseClicked(togglePause);
+
         })
         .catch(error => console.error(error));
 }
 
+// fetch the log and open it, both formats give the same object:
+// scene and the dimensions as in the JSON log, numFish, numSharks, numFood, wall,
+// numFrames logged frames of the steps firstStep, firstStep + stepInterval, ... lastStep,
+// deadFish, eatenFood (since the previous frame) and eatenFoodTotal of every frame (typed arrays indexed by frame),
+// and frame(index) returning typed arrays of the entities in that frame: fishX, fishY, fishDir, fishAlive,
+// fishLogged (only the logged fish are valid), sharkX, sharkY, sharkDir, foodX, foodY
+function loadTrajectory(url) {
+    return fetch(url)
+        .then(response => response.arrayBuffer())
+        .then(buffer => {
+            let magic = new Uint8Array(buffer, 0, Math.min(4, buffer.byteLength));
+            if (String.fromCharCode(...magic) == 'FSTR')
+                return openTrajectory(buffer);
+            return fromJson(JSON.parse(new TextDecoder().decode(buffer)));
+        })
+        .then(t => {
+            t.lastStep = t.firstStep + Math.max(0, t.numFrames - 1) * t.stepInterval;
+            t.eatenFoodTotal = new Uint32Array(t.numFrames);
+            t.eatenFood.reduce((total, eaten, f) => t.eatenFoodTotal[f] = total + eaten, 0);
+            return t;
+        });
+}
+
+// the JSON log is converted as a whole, frames are views of the arrays of all steps
+function fromJson(log) {
+    let steps = log.steps;
+    let numSteps = steps.length;
+    // fish are stored by their ids, a log may list only some of them (older logs list all and have no numFish)
+    let numFish = log.numFish ?? steps[0].swarm.length;
+    let numSharks = steps[0].sharks.length, numFood = steps[0].food.length;
+    let all = {
+        fishX: new Float32Array(numSteps * numFish),
+        fishY: new Float32Array(numSteps * numFish),
+        fishDir: new Float32Array(numSteps * numFish),
+        fishAlive: new Uint8Array(numSteps * numFish),
+        fishLogged: new Uint8Array(numSteps * numFish),
+        sharkX: new Float32Array(numSteps * numSharks),
+        sharkY: new Float32Array(numSteps * numSharks),
+        sharkDir: new Float32Array(numSteps * numSharks),
+        foodX: new Float32Array(numSteps * numFood),
+        foodY: new Float32Array(numSteps * numFood),
+    };
+    let t = {
+        scene: log.scene,
+        fish_dim_x: log.fish_dim_x,
+        fish_dim_y: log.fish_dim_y,
+        shark_dim_x: log.shark_dim_x,
+        shark_dim_y: log.shark_dim_y,
+        shark_kill_radius: log.shark_kill_radius,
+        shark_sense_dist: log.shark_sense_dist,
+        shark_blind_angle_back: log.shark_blind_angle_back,
+        wall: log.wall ?? false,
+        firstStep: log.firstStep ?? 0,
+        stepInterval: log.stepInterval ?? 1,
+        numFrames: numSteps,
+        numFish: numFish,
+        numSharks: numSharks,
+        numFood: numFood,
+        deadFish: new Uint32Array(numSteps),
+        eatenFood: new Uint32Array(numSteps),
+    };
+
+    steps.forEach((step, s) => {
+        step.swarm.forEach(fish => {
+            let k = s * numFish + fish.id;
+            all.fishX[k] = fish.x;
+            all.fishY[k] = fish.y;
+            all.fishDir[k] = fish.dir;
+            all.fishAlive[k] = fish.alive ? 1 : 0;
+            all.fishLogged[k] = 1;
+        });
+        step.sharks.forEach((shark, i) => {
+            let k = s * numSharks + i;
+            all.sharkX[k] = shark.x;
+            all.sharkY[k] = shark.y;
+            all.sharkDir[k] = shark.dir;
+        });
+        step.food.forEach((food, i) => {
+            let k = s * numFood + i;
+            all.foodX[k] = food.x;
+            all.foodY[k] = food.y;
+        });
+        t.deadFish[s] = step.deadFish;
+        t.eatenFood[s] = step.eatenFood;
+    });
+
+    let view = (array, n, s) => array.subarray(s * n, (s + 1) * n);
+    t.frame = s => ({
+        fishX: view(all.fishX, numFish, s),
+        fishY: view(all.fishY, numFish, s),
+        fishDir: view(all.fishDir, numFish, s),
+        fishAlive: view(all.fishAlive, numFish, s),
+        fishLogged: view(all.fishLogged, numFish, s),
+        sharkX: view(all.sharkX, numSharks, s),
+        sharkY: view(all.sharkY, numSharks, s),
+        sharkDir: view(all.sharkDir, numSharks, s),
+        foodX: view(all.foodX, numFood, s),
+        foodY: view(all.foodY, numFood, s),
+    });
+    return t;
+}
+
+// binary trajectory format, versions 1 to 3 (see simulation-cpp/trajectory.hpp)
+const TRAJECTORY_DELTA = 1;
+const TRAJECTORY_HEADING_8BIT = 2;
+const TRAJECTORY_FISH_SUBSET = 4;
+const TRAJECTORY_WALL = 8;
+
+// a whole frame, with at least its 16 bytes of header, starts at `offset` and ends before `end`
+function frameFits(view, offset, end, headerSize) {
+    if (offset < headerSize || offset + 16 > end)
+        return false;
+    let size = view.getUint32(offset, true);
+    return size >= 12 && offset + 4 + size <= end;
+}
+
+// offsets of all frames, from the index at the end of the file (version 2), or by walking through the frames
+// if there is none (version 1, or the simulation did not finish)
+function frameOffsets(view, version, headerSize) {
+    let length = view.byteLength;
+    if (version >= 2 && length >= headerSize + 16) {
+        let footer = length - 16;
+        let magic = String.fromCharCode(...new Uint8Array(view.buffer, footer + 12, 4));
+        let indexOffset = Number(view.getBigUint64(footer, true));
+        let frames = view.getUint32(footer + 8, true);
+        if (magic == 'FIDX' && indexOffset + 8 * frames + 16 == length) {
+            let offsets = new Array(frames);
+            for (let s = 0; s < frames; s++) {
+                offsets[s] = Number(view.getBigUint64(indexOffset + 8 * s, true));
+                // the frames must lie between the header and the index
+                if (!frameFits(view, offsets[s], indexOffset, headerSize))
+                    throw new Error("the index of the trajectory points outside of its frames");
+            }
+            return offsets;
+        }
+    }
+    let offsets = [];
+    for (let offset = headerSize; frameFits(view, offset, length, headerSize); offset += 4 + view.getUint32(offset, true))
+        offsets.push(offset);
+    return offsets;
+}
+
+// frames are decoded on demand: from the closest key frame before the requested step, or from the previous
+// decoded frame when playing forward, so seeking costs at most one key frame interval of decoding
+function openTrajectory(buffer) {
+    let view = new DataView(buffer);
+    let bytes = new Uint8Array(buffer);
+    let version = view.getUint16(4, true);
+    if (version < 1 || version > 3)
+        throw new Error("unsupported trajectory version " + version);
+    let headerSize = version >= 3 ? 80 : 64;
+    let flags = view.getUint16(6, true);
+    let width = view.getUint32(8, true);
+    let height = view.getUint32(12, true);
+    let numFish = view.getUint32(20, true);
+    let numSharks = view.getUint32(24, true);
+    let numFood = view.getUint32(28, true);
+    let offsets = frameOffsets(view, version, headerSize);
+    let numSteps = offsets.length;
+
+    let t = {
+        scene: {width: width, height: height},
+        fish_dim_x: view.getFloat32(36, true),
+        fish_dim_y: view.getFloat32(40, true),
+        shark_dim_x: view.getFloat32(44, true),
+        shark_dim_y: view.getFloat32(48, true),
+        shark_kill_radius: view.getFloat32(52, true),
+        shark_sense_dist: view.getFloat32(56, true),
+        shark_blind_angle_back: view.getFloat32(60, true),
+        wall: (flags & TRAJECTORY_WALL) != 0,
+        firstStep: version >= 3 ? view.getUint32(64, true) : 0,
+        stepInterval: version >= 3 ? view.getUint32(68, true) : 1,
+        numFrames: numSteps,
+        numFish: numFish,
+        numSharks: numSharks,
+        numFood: numFood,
+        deadFish: new Uint32Array(numSteps),
+        eatenFood: new Uint32Array(numSteps),
+    };
+    offsets.forEach((offset, s) => {
+        t.deadFish[s] = view.getUint32(offset + 8, true);
+        t.eatenFood[s] = view.getUint32(offset + 12, true);
+    });
+
+    // quantized channels: fish x, y, heading, shark x, y, heading, food x, y
+    let headingRange = (flags & TRAJECTORY_HEADING_8BIT) ? 256 : 65536;
+    let sizes = [numFish, numFish, numFish, numSharks, numSharks, numSharks, numFood, numFood];
+    let ranges = [65536, 65536, headingRange, 65536, 65536, headingRange, 65536, 65536];
+    let current = sizes.map(n => new Uint16Array(n));
+    let previous = sizes.map(n => new Uint16Array(n));
+    let beforePrevious = sizes.map(n => new Uint16Array(n));
+    let decoded = -1;       // frame whose channels are in `current`
+    let aliveAt = 0;        // offset of the alive bits of that frame
+
+    // fish logged in the decoded frame (all of them without the fish subset flag), sharks and food are always
+    // logged, and the order of the prediction of every value (see predictValue in trajectory.hpp)
+    let subset = (flags & TRAJECTORY_FISH_SUBSET) != 0;
+    let logged = new Uint8Array(numFish).fill(1);
+    let everything = new Uint8Array(Math.max(numFish, numSharks, numFood)).fill(1);
+    let streaks = sizes.map(n => new Uint8Array(n));
+
+    let isKey = f => view.getUint8(offsets[f] + 4) == 0;
+
+    // throws if the frame is truncated or corrupt, rather than reading past its end
+    function decode(f) {
+        [beforePrevious, previous, current] = [previous, current, beforePrevious];
+        let key = isKey(f);
+        let p = offsets[f] + 16;
+        let end = offsets[f] + 4 + view.getUint32(offsets[f], true);
+        let need = n => {
+            if (p + n > end)
+                throw new Error("frame " + f + " of the trajectory is truncated");
+        };
+        if (subset) {
+            need((numFish + 7) >> 3);
+            for (let i = 0; i < numFish; i++)
+                logged[i] = (bytes[p + (i >> 3)] >> (i & 7)) & 1;
+            p += (numFish + 7) >> 3;
+        }
+        for (let c = 0; c < 8; c++) {
+            let inFrame = c < 3 ? logged : everything;
+            let values = current[c], prev = previous[c], before = beforePrevious[c], streak = streaks[c];
+            let mask = ranges[c] - 1;
+            if (key && ranges[c] != 256) {
+                need(p & 1);
+                p += p & 1;
+            }
+            for (let i = 0; i < sizes[c]; i++) {
+                if (!inFrame[i]) {
+                    // unlogged fish are reset at key frames, so seeking gives the same values as playing
+                    values[i] = key ? 0 : prev[i];
+                } else if (key && ranges[c] == 256) {
+                    need(1);
+                    values[i] = bytes[p++];
+                } else if (key) {
+                    need(2);
+                    values[i] = bytes[p] | (bytes[p + 1] << 8);
+                    p += 2;
+                } else {
+                    // zigzag varint residual of the prediction from the previous frames
+                    let v = 0, shift = 0, b;
+                    do {
+                        need(1);
+                        if (shift > 28)
+                            throw new Error("frame " + f + " of the trajectory is corrupt");
+                        b = bytes[p++];
+                        v |= (b & 0x7f) << shift;
+                        shift += 7;
+                    } while (b & 0x80);
+                    let residual = (v >>> 1) ^ -(v & 1);
+                    let order = streak[i];
+                    let predicted = order == 0 ? 0 : order == 1 ? prev[i] : 2 * prev[i] - before[i];
+                    values[i] = (predicted + residual) & mask;
+                }
+                streak[i] = !inFrame[i] ? 0 : key ? 1 : Math.min(streak[i] + 1, 2);
+            }
+        }
+        need((numFish + 7) >> 3);
+        aliveAt = p;
+    }
+
+    let frame = {
+        fishX: new Float32Array(numFish),
+        fishY: new Float32Array(numFish),
+        fishDir: new Float32Array(numFish),
+        fishAlive: new Uint8Array(numFish),
+        fishLogged: new Uint8Array(numFish),
+        sharkX: new Float32Array(numSharks),
+        sharkY: new Float32Array(numSharks),
+        sharkDir: new Float32Array(numSharks),
+        foodX: new Float32Array(numFood),
+        foodY: new Float32Array(numFood),
+    };
+
+    // the returned arrays are reused by the next call
+    t.frame = f => {
+        if (f != decoded) {
+            let key = f;
+            while (!isKey(key)) {
+                if (key == 0)
+                    throw new Error("trajectory does not start with a key frame");
+                key--;
+            }
+            let from = (decoded >= key && decoded < f) ? decoded + 1 : key;
+            decoded = -1;   // until the decoding succeeded
+            for (let k = from; k <= f; k++)
+                decode(k);
+            decoded = f;
+        }
+
+        // positions back to the scene, headings to radians
+        let toX = width / 65536, toY = height / 65536;
+        let toFishDir = 2 * Math.PI / ranges[2], toSharkDir = 2 * Math.PI / ranges[5];
+        for (let i = 0; i < numFish; i++) {
+            frame.fishX[i] = (current[0][i] + 0.5) * toX;
+            frame.fishY[i] = (current[1][i] + 0.5) * toY;
+            frame.fishDir[i] = current[2][i] * toFishDir;
+            frame.fishAlive[i] = (bytes[aliveAt + (i >> 3)] >> (i & 7)) & 1;
+            frame.fishLogged[i] = logged[i];
+        }
+        for (let i = 0; i < numSharks; i++) {
+            frame.sharkX[i] = (current[3][i] + 0.5) * toX;
+            frame.sharkY[i] = (current[4][i] + 0.5) * toY;
+            frame.sharkDir[i] = current[5][i] * toSharkDir;
+        }
+        for (let i = 0; i < numFood; i++) {
+            frame.foodX[i] = (current[6][i] + 0.5) * toX;
+            frame.foodY[i] = (current[7][i] + 0.5) * toY;
+        }
+        return frame;
+    };
+    return t;
+}
+
+// jump to a step
+function seek(step) {
+    logger.step = step - 1;
+    render_step(output);
+}
+
+// copies of the last two frames used for the interpolation (frame() of a binary log reuses its arrays)
+let frameCache = new Map();
+
+function cachedFrame(output, index) {
+    if (!frameCache.has(index)) {
+        if (frameCache.size >= 2)
+            frameCache.delete(frameCache.keys().next().value);
+        let frame = output.frame(index);
+        frameCache.set(index, Object.fromEntries(Object.entries(frame).map(([key, values]) => [key, values.slice()])));
+    }
+    return frameCache.get(index);
+}
+
+// difference b - a of positions (the shorter way around a scene without walls) or angles
+function wrappedDelta(a, b, size) {
+    let d = b - a;
+    if (d > size / 2) d -= size;
+    else if (d < -size / 2) d += size;
+    return d;
+}
+
+// state at a simulation step and the index of the logged frame at or before it,
+// fish and sharks are interpolated between the logged frames (food and the alive flags are the earlier frame's)
+let tweened;
+
+function stateAt(output, step) {
+    let position = (step - output.firstStep) / output.stepInterval;
+    let index = Math.min(Math.max(Math.floor(position), 0), output.numFrames - 1);
+    let alpha = position - index;
+    let a = cachedFrame(output, index);
+    if (alpha <= 0 || index + 1 >= output.numFrames)
+        return {frame: a, index: index};
+
+    let b = cachedFrame(output, index + 1);
+    tweened = tweened || Object.fromEntries(Object.entries(a).map(([key, values]) => [key, values.slice()]));
+    let w = output.scene.width, h = output.scene.height;
+    let lerpPosition = (x0, x1, size) => {
+        if (output.wall) return x0 + (x1 - x0) * alpha;
+        return (x0 + wrappedDelta(x0, x1, size) * alpha + size) % size;
+    };
+    let lerpAngle = (a0, a1) => a0 + wrappedDelta(a0, a1, 2 * Math.PI) * alpha;
+    for (let i = 0; i < output.numFish; i++) {
+        let both = a.fishLogged[i] && b.fishLogged[i];
+        tweened.fishX[i] = both ? lerpPosition(a.fishX[i], b.fishX[i], w) : a.fishX[i];
+        tweened.fishY[i] = both ? lerpPosition(a.fishY[i], b.fishY[i], h) : a.fishY[i];
+        tweened.fishDir[i] = both ? lerpAngle(a.fishDir[i], b.fishDir[i]) : a.fishDir[i];
+    }
+    for (let i = 0; i < output.numSharks; i++) {
+        tweened.sharkX[i] = lerpPosition(a.sharkX[i], b.sharkX[i], w);
+        tweened.sharkY[i] = lerpPosition(a.sharkY[i], b.sharkY[i], h);
+        tweened.sharkDir[i] = lerpAngle(a.sharkDir[i], b.sharkDir[i]);
+    }
+    tweened.fishAlive.set(a.fishAlive);
+    tweened.fishLogged.set(a.fishLogged);
+    tweened.foodX.set(a.foodX);
+    tweened.foodY.set(a.foodY);
+    return {frame: tweened, index: index};
+}
+
+function togglePause() {
+    logger.paused = !logger.paused;
+    pauseButton.html(logger.paused ? "Play" : "Pause");
+}
+
 function increaseFrameRate() {
     logger.frameRate += 5;
     frameRateButton.html("Frame Rate: " + logger.frameRate)
@@ -82,23 +473,30 @@ function render_step(output) {
     clear();
 
 
+    let state = stateAt(output, i);
+    let frame = state.frame;
+
     // render food
-    output.steps[i].food.forEach(el => {
+    for (let k = 0; k < output.numFood; k++) {
         push();
         fill('grey');
         stroke('grey');
 
         // draw the ellipse at the origin
-        ellipse(el.x, el.y, 2, 2);
+        ellipse(frame.foodX[k], frame.foodY[k], 2, 2);
 
         pop();
-    });
+    }
 
 
     // render fish
-    output.steps[i].swarm.forEach(element => {
+    for (let k = 0; k < output.numFish; k++) {
+        // fish that are not in the log
+        if (!frame.fishLogged[k]) continue;
+
+        let element = {x: frame.fishX[k], y: frame.fishY[k], dir: frame.fishDir[k]};
         // render alive fish
-        if (element.alive == true) {
+        if (frame.fishAlive[k]) {
             // stroke(0);
             // fill(0);
             // ellipse(element.x, element.y, 10, 10);
@@ -125,11 +523,12 @@ function render_step(output) {
             line(element.x, element.y - crossSize / 2, element.x, element.y + crossSize / 2); // vertical line
             pop();
         }
-    });
+    }
 
 
     // render sharks
-    output.steps[i].sharks.forEach(el => {
+    for (let k = 0; k < output.numSharks; k++) {
+        let el = {x: frame.sharkX[k], y: frame.sharkY[k], dir: frame.sharkDir[k]};
         push();
 
         // translate to where you want the center of the ellipse to be
@@ -158,24 +557,20 @@ function render_step(output) {
         arc(0, 0, output.shark_sense_dist, output.shark_sense_dist, -HALF_PI + rad/2, HALF_PI + PI - rad/2, PIE);
 
         pop();
-    });
+    }
 
     stepCounter.html("Step: " + i);
-    deadFishCounter.html("Dead Fish: " + output.steps[i].deadFish)
-    logger.numFoodEaten += output.steps[i].eatenFood;
+    stepSlider.value(i);
+    deadFishCounter.html("Dead Fish: " + output.deadFish[state.index])
+    logger.numFoodEaten = output.eatenFoodTotal[state.index];
     eatenFoodCounter.html("Eaten food pieces: " + logger.numFoodEaten)
 }
 
 function draw() {
-    if (logger.step == 0) {
-        fetch('../output.json')
-            .then(response => response.json())
-            .then(output => {
-                render_step(output);
-            })
-            .catch(error => console.error(error));
-    }
-    else if (logger.step < logger.stepsTotal - 1) {
+    // wait for the log
+    if (!output || logger.paused) return;
+
+    if (logger.step < logger.stepsTotal - 1) {
         render_step(output);
     }
 }